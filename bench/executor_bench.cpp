@@ -0,0 +1,110 @@
+#include "MPP_MCpp/v4d/executor.h"
+#include "MPP_MCpp/v4d/work_stealing_executor.h"
+
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <vector>
+
+
+// Executor schedule throughput, at 1..N threads
+// Every item is a coroutine handle that just counts down, so what is measured is the queueing and the wake-ups
+// The bulk variant schedules the items in batches of 16, as continuation_manager does with the continuations of a task
+
+namespace {
+    using namespace rtc::coro::mpp_mcpp::v4d;
+
+    // Coroutine that counts down every time it is resumed, and never finishes
+    struct countdown {
+        struct promise_type {
+            countdown get_return_object() noexcept {
+                return countdown{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {}
+        };
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // Counts down once the coroutine is already suspended, so it can be scheduled again right away
+    struct count_down {
+        std::atomic<std::size_t>& pending_;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) const noexcept {
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                pending_.notify_all();
+            }
+        }
+        void await_resume() const noexcept {}
+    };
+
+    countdown counting(std::atomic<std::size_t>& pending) {
+        for (;;) {
+            co_await count_down{ pending };
+        }
+    }
+
+    template <typename executor_t>
+    void BM_executor_schedule(benchmark::State& state) {
+        constexpr std::size_t items{ 4096 };
+        executor_t executor{ static_cast<std::size_t>(state.range(0)) };
+        std::atomic<std::size_t> pending{};
+        std::vector<countdown> coroutines;
+        coroutines.reserve(items);
+        for (std::size_t i{ 0 }; i < items; ++i) {
+            coroutines.push_back(counting(pending));
+        }
+        for (auto _ : state) {
+            pending.store(items, std::memory_order_release);
+            for (auto& c : coroutines) {
+                executor.schedule(std::coroutine_handle<>{ c.handle_ });
+            }
+            for (auto p{ pending.load(std::memory_order_acquire) }; p != 0; p = pending.load(std::memory_order_acquire)) {
+                pending.wait(p, std::memory_order_acquire);
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * items);
+        for (auto& c : coroutines) {
+            c.handle_.destroy();
+        }
+    }
+
+    template <typename executor_t>
+    void BM_executor_schedule_bulk(benchmark::State& state) {
+        constexpr std::size_t items{ 4096 };
+        constexpr std::size_t batch_size{ 16 };
+        executor_t executor{ static_cast<std::size_t>(state.range(0)) };
+        std::atomic<std::size_t> pending{};
+        std::vector<countdown> coroutines;
+        coroutines.reserve(items);
+        for (std::size_t i{ 0 }; i < items; ++i) {
+            coroutines.push_back(counting(pending));
+        }
+        std::vector<work_item> batch(batch_size);
+        for (auto _ : state) {
+            pending.store(items, std::memory_order_release);
+            for (std::size_t i{ 0 }; i < items; i += batch_size) {
+                for (std::size_t j{ 0 }; j < batch_size; ++j) {
+                    batch[j] = std::coroutine_handle<>{ coroutines[i + j].handle_ };
+                }
+                executor.schedule_bulk(batch);
+            }
+            for (auto p{ pending.load(std::memory_order_acquire) }; p != 0; p = pending.load(std::memory_order_acquire)) {
+                pending.wait(p, std::memory_order_acquire);
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * items);
+        for (auto& c : coroutines) {
+            c.handle_.destroy();
+        }
+    }
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_executor_schedule, executor)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_executor_schedule, work_stealing_executor)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_executor_schedule_bulk, executor)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_executor_schedule_bulk, work_stealing_executor)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
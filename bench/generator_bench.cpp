@@ -0,0 +1,82 @@
+#include "chunked_generator.h"
+#include "frame_pool.h"
+
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstddef>  // byte, size_t
+#include <generator.hpp>
+#include <span>
+
+
+// std::generator iteration, per element
+// The frame is created once per run, so what is measured is the cost of a co_yield and a resume
+// chunked_generator yields the same elements in spans, so it only pays a resume per span
+
+namespace {
+    template <typename allocator_t>
+    std::generator<int, void, allocator_t> sequence(int n) {
+        for (int i{ 0 }; i < n; ++i) {
+            co_yield i;
+        }
+    }
+
+    template <typename allocator_t>
+    void BM_generator_iteration(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : sequence<allocator_t>(n)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template <std::size_t chunk_size>
+    rtc::coro::chunked_generator<int> chunked_sequence(int n) {
+        std::array<int, chunk_size> buffer{};
+        for (int i{ 0 }; i < n; ) {
+            std::size_t size{ 0 };
+            for (; size < chunk_size && i < n; ++size) {
+                buffer[size] = i++;
+            }
+            co_yield std::span<const int>{ buffer.data(), size };
+        }
+    }
+
+    template <std::size_t chunk_size>
+    void BM_chunked_generator_iteration(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : chunked_sequence<chunk_size>(n)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    template <std::size_t chunk_size>
+    void BM_chunked_generator_chunks(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            auto gen{ chunked_sequence<chunk_size>(n) };
+            for (auto chunk : gen.chunks()) {
+                for (auto i : chunk) {
+                    sum += i;
+                }
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_generator_iteration, void)->Arg(1)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_generator_iteration, rtc::coro::frame_allocator<std::byte>)->Arg(1)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_chunked_generator_iteration, 1)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_chunked_generator_iteration, 256)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_chunked_generator_chunks, 256)->Arg(1024);
@@ -0,0 +1,336 @@
+#include "affinity.h"
+#include "client_server_asio.h"
+#include "framing.h"
+#include "io_context_pool.h"
+#include "metrics.h"
+
+#include <algorithm>  // min
+#include <asio.hpp>
+#include <charconv>  // from_chars
+#include <chrono>
+#include <cstddef>  // byte, size_t
+#include <cstdint>  // uint16_t, uint32_t, uint64_t
+#include <exception>
+#include <fmt/core.h>
+#include <future>
+#include <memory>  // make_shared, shared_ptr
+#include <optional>
+#include <stdexcept>  // invalid_argument, runtime_error
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>  // move
+#include <vector>
+
+
+// Load generator for the pipelined client_server_asio server
+//
+// Opens many connections, sends fixed-size requests over all of them, for a while, at a given rate or as fast as
+// the window of requests in flight per connection allows, and reports the throughput and the latency percentiles, e.g.
+//   coro_load_generator --serve --connections=2000 --window=4 --size=256 --duration=10
+//   coro_load_generator --host=10.0.0.2 --connections=5000 --rate=100000
+//
+// Notes on implementation:
+//
+//   - Connections are spread over an io_context pool, and every one of them runs a sender and a receiver coroutine;
+//     all connections are opened before the clock starts, so connecting isn't measured
+//   - With --rate, every connection sends on a fixed schedule, one request every connections / rate seconds, staggered
+//     over the connections, and latency is measured from the time a request was due on that schedule, not from the time
+//     it was written: a request sent late, because the window was full or the sender fell behind, is charged the delay,
+//     so a saturated server can't hide its queueing delay (coordinated omission)
+//   - Without --rate, a connection sends whenever its window has room, so a request is due when it's written, and
+//     latency is the round trip
+//   - Latencies go into one metrics::histogram per io_context, which only that io_context's thread records into
+
+
+namespace {
+    using namespace rtc::coro;
+
+    struct options {
+        std::string host{ "localhost" };
+        std::uint16_t port{ client_server_asio::port };
+        std::size_t connections{ 1000 };
+        double rate{ 0.0 };  // requests per second, over all connections; 0 is as fast as the window allows
+        std::size_t window{ 1 };  // requests in flight per connection
+        std::size_t payload_size{ 64 };
+        double duration{ 10.0 };  // seconds
+        std::size_t threads{ number_of_cores() };
+        bool serve{ false };  // runs a pipelined server in the same process
+    };
+
+    constexpr std::string_view usage{
+        "Usage: coro_load_generator [--host=localhost] [--port=1234] [--connections=1000] [--rate=0] [--window=1]\n"
+        "                           [--size=64] [--duration=10] [--threads=<cores>] [--serve]\n"
+        "  --rate: requests per second over all connections, 0 for as fast as the window allows\n"
+        "  --window: requests in flight per connection\n"
+        "  --size: request payload size in bytes, echoed back by the server\n"
+        "  --duration: seconds of load\n"
+        "  --serve: runs a pipelined server in the same process\n"
+    };
+
+    template <typename T>
+    T parse_number(std::string_view name, std::string_view value) {
+        T number{};
+        auto [end, ec] { std::from_chars(value.data(), value.data() + value.size(), number) };
+        if (ec != std::errc{} || end != value.data() + value.size()) {
+            throw std::invalid_argument{ fmt::format("invalid value for --{}: '{}'", name, value) };
+        }
+        return number;
+    }
+
+    // Returns no options if the usage was asked for
+    std::optional<options> parse_options(int argc, char** argv) {
+        options o{};
+        for (int i{ 1 }; i < argc; ++i) {
+            std::string_view arg{ argv[i] };
+            if (arg == "--help" || arg == "-h") {
+                return std::nullopt;
+            }
+            if (arg == "--serve") {
+                o.serve = true;
+                continue;
+            }
+            auto equal{ arg.find('=') };
+            if (not arg.starts_with("--") || equal == std::string_view::npos) {
+                throw std::invalid_argument{ fmt::format("unknown argument '{}'", arg) };
+            }
+            auto name{ arg.substr(2, equal - 2) };
+            auto value{ arg.substr(equal + 1) };
+            if (name == "host") { o.host = value; }
+            else if (name == "port") { o.port = parse_number<std::uint16_t>(name, value); }
+            else if (name == "connections") { o.connections = parse_number<std::size_t>(name, value); }
+            else if (name == "rate") { o.rate = parse_number<double>(name, value); }
+            else if (name == "window") { o.window = parse_number<std::size_t>(name, value); }
+            else if (name == "size") { o.payload_size = parse_number<std::size_t>(name, value); }
+            else if (name == "duration") { o.duration = parse_number<double>(name, value); }
+            else if (name == "threads") { o.threads = parse_number<std::size_t>(name, value); }
+            else { throw std::invalid_argument{ fmt::format("unknown option --{}", name) }; }
+        }
+        if (o.connections == 0 || o.window == 0 || o.threads == 0 || o.payload_size > framing::max_payload_size) {
+            throw std::invalid_argument{ "--connections, --window, and --threads should be greater than 0, "
+                "and --size at most framing::max_payload_size" };
+        }
+        return o;
+    }
+
+
+    // Per io_context
+    struct statistics {
+        metrics::counter<> sent;
+        metrics::counter<> received;
+        metrics::histogram latency;  // nanoseconds
+    };
+
+    // Shared by a connection's sender and receiver, so it lives until both are done
+    struct connection {
+        connection(asio::io_context& io_ctx, statistics& s)
+            : socket{ io_ctx }
+            , window_timer{ io_ctx }
+            , stats{ &s }
+        {}
+
+        asio::ip::tcp::socket socket;
+        framing::frame_writer<asio::ip::tcp::socket> writer{ socket };
+        asio::steady_timer window_timer;  // cancelled whenever a response frees a slot of the window
+        std::unordered_map<std::uint32_t, std::uint64_t> in_flight;  // request id to due time
+        statistics* stats;
+        bool closed{ false };
+    };
+
+    asio::awaitable<std::shared_ptr<connection>> open_connection(asio::io_context& io_ctx, statistics& stats,
+        asio::ip::tcp::resolver::results_type endpoints) {
+        auto c{ std::make_shared<connection>(io_ctx, stats) };
+        co_await asio::async_connect(c->socket, endpoints, asio::use_awaitable);
+        c->socket.set_option(asio::ip::tcp::no_delay{ true });
+        co_return c;
+    }
+
+    // Sends requests until end, then shuts the sending side down, so the server closes the connection
+    // once it has written the last response
+    // Paced, the k-th request is due at start + (k + index / connections) * connections / rate
+    asio::awaitable<void> send_requests(std::shared_ptr<connection> c, const options& o, std::size_t index,
+        metrics::clock::time_point start, metrics::clock::time_point end) {
+        auto paced{ o.rate > 0.0 };
+        auto connections{ static_cast<double>(o.connections) };
+        auto phase{ static_cast<double>(index) / connections };
+        asio::steady_timer pace_timer{ c->socket.get_executor() };
+        std::vector<std::byte> payload(o.payload_size, std::byte{ 0x2a });
+        std::uint32_t id{ 0 };
+        for (std::uint64_t k{ 0 }; not c->closed; ++k) {
+            auto due{ metrics::clock::now() };
+            if (paced) {
+                due = start + std::chrono::duration_cast<metrics::clock::duration>(
+                    std::chrono::duration<double>{ (static_cast<double>(k) + phase) * connections / o.rate });
+                if (due >= end || metrics::clock::now() >= end) {
+                    break;  // requests still due by the end, if the sender fell behind, are never sent
+                }
+                if (due > metrics::clock::now()) {
+                    asio::error_code ec{};
+                    pace_timer.expires_at(due);
+                    co_await pace_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                }
+            }
+            while (not c->closed && c->in_flight.size() >= o.window) {
+                asio::error_code ec{};
+                c->window_timer.expires_at(asio::steady_timer::time_point::max());
+                co_await c->window_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+            }
+            if (not paced) {
+                due = metrics::clock::now();
+                if (due >= end) {
+                    break;
+                }
+            }
+            if (c->closed) {
+                break;
+            }
+            c->in_flight.emplace(id, static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch()).count()));
+            co_await c->writer.write(id++, payload);
+            c->stats->sent.add();
+        }
+        asio::error_code ec{};
+        c->socket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+    }
+
+    asio::awaitable<void> receive_responses(std::shared_ptr<connection> c, std::size_t buffer_size) {
+        framing::frame_reader reader{ c->socket, buffer_size };
+        try {
+            for (;;) {
+                auto response{ co_await reader.read() };
+                if (not response) {
+                    break;
+                }
+                auto it{ c->in_flight.find(response->id) };
+                if (it == c->in_flight.end()) {
+                    throw std::runtime_error{ fmt::format("response to an unknown request {}", response->id) };
+                }
+                c->stats->latency.record(metrics::now() - it->second);
+                c->stats->received.add();
+                c->in_flight.erase(it);
+                c->window_timer.cancel();
+            }
+        } catch (...) {
+            c->closed = true;
+            c->window_timer.cancel();
+            throw;
+        }
+        c->closed = true;
+        c->window_timer.cancel();
+        if (not c->in_flight.empty()) {
+            throw std::runtime_error{ fmt::format("connection closed with {} requests in flight", c->in_flight.size()) };
+        }
+    }
+
+    asio::awaitable<void> run_connection(std::shared_ptr<connection> c, const options& o, std::size_t index,
+        metrics::clock::time_point start, metrics::clock::time_point end) {
+        co_spawn(c->socket.get_executor(), send_requests(c, o, index, start, end), asio::detached);
+        co_await receive_responses(c, std::min(o.payload_size + framing::header_size, std::size_t{ 64 * 1024 }));
+    }
+
+    // Nanoseconds to microseconds
+    double us(std::uint64_t ns) noexcept {
+        return static_cast<double>(ns) / 1'000.0;
+    }
+
+    // Connections that failed to open, or broke, don't count as connected
+    void report(const options& o, const std::vector<statistics>& stats, std::size_t connected, std::size_t failed,
+        std::chrono::duration<double> elapsed) {
+        std::uint64_t sent{};
+        std::uint64_t received{};
+        metrics::histogram_snapshot latency{};
+        for (auto& s : stats) {
+            sent += s.sent.load();
+            received += s.received.load();
+            s.latency.add_to(latency);
+        }
+        auto seconds{ elapsed.count() };
+        auto per_second{ seconds > 0.0 ? static_cast<double>(received) / seconds : 0.0 };
+        fmt::print("\n[load] {} connections ({} failed), window {}, {} byte payloads, {:.1f} s\n",
+            connected, failed, o.window, o.payload_size, seconds);
+        fmt::print("[load] Requests: {} sent, {} received\n", sent, received);
+        fmt::print("[load] Throughput: {:.0f} requests/s, {:.2f} MiB/s each way\n",
+            per_second, per_second * static_cast<double>(o.payload_size + framing::header_size) / (1024.0 * 1024.0));
+        fmt::print("[load] Latency (us): mean {:.1f}, p50 {:.1f}, p99 {:.1f}, p999 {:.1f}, max {:.1f}\n",
+            us(latency.mean()), us(latency.percentile(50)), us(latency.percentile(99)), us(latency.percentile(99.9)),
+            us(latency.max()));
+    }
+
+    void run(const options& o) {
+        std::optional<io_context_pool> server_pool{};
+        if (o.serve) {
+            server_pool.emplace(o.threads);
+            client_server_asio::start_server(*server_pool, client_server_asio::accept_mode::hand_off, { .pipelined = true });
+            server_pool->run();
+        }
+
+        io_context_pool pool{ o.threads };
+        pool.run();
+        std::vector<statistics> stats(pool.size());
+
+        asio::ip::tcp::resolver resolver{ pool.get_io_context(0) };
+        auto endpoints{ resolver.resolve(o.host, std::to_string(o.port)) };
+
+        fmt::print("[load] Opening {} connections to {}:{}...\n", o.connections, o.host, o.port);
+        std::vector<std::future<std::shared_ptr<connection>>> opening;
+        opening.reserve(o.connections);
+        for (std::size_t i{ 0 }; i < o.connections; ++i) {
+            auto index{ pool.next_index() };
+            opening.push_back(co_spawn(pool.get_io_context(index),
+                open_connection(pool.get_io_context(index), stats[index], endpoints), asio::use_future));
+        }
+        std::vector<std::shared_ptr<connection>> connections;
+        std::size_t failed{ 0 };
+        for (auto& f : opening) {
+            try {
+                connections.push_back(f.get());
+            } catch (const std::exception& e) {
+                if (failed++ == 0) {
+                    fmt::print("[load] Failed to connect: {}\n", e.what());
+                }
+            }
+        }
+
+        fmt::print("[load] Running for {} s...\n", o.duration);
+        auto start{ metrics::clock::now() };
+        auto end{ start + std::chrono::duration_cast<metrics::clock::duration>(std::chrono::duration<double>{ o.duration }) };
+        std::vector<std::future<void>> running;
+        running.reserve(connections.size());
+        for (std::size_t i{ 0 }; i < connections.size(); ++i) {
+            auto& c{ connections[i] };
+            running.push_back(co_spawn(c->socket.get_executor(), run_connection(c, o, i, start, end), asio::use_future));
+        }
+        std::size_t broken{ 0 };
+        for (auto& f : running) {
+            try {
+                f.get();
+            } catch (const std::exception& e) {
+                if (broken++ == 0) {
+                    fmt::print("[load] Connection failed: {}\n", e.what());
+                }
+            }
+        }
+        std::chrono::duration<double> elapsed{ metrics::clock::now() - start };
+
+        pool.stop();
+        if (server_pool) {
+            server_pool->stop();
+        }
+        report(o, stats, connections.size() - broken, failed + broken, elapsed);
+    }
+}  // namespace
+
+
+int main(int argc, char** argv) {
+    try {
+        auto o{ parse_options(argc, argv) };
+        if (not o) {
+            fmt::print("{}", usage);
+            return 0;
+        }
+        run(*o);
+    } catch (const std::exception& e) {
+        fmt::print("Error: {}\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,71 @@
+#include "coro_sequence.h"
+#include "MPP_MCpp/v4d/parallel_for_each.h"
+#include "pipeline.h"
+
+#include <benchmark/benchmark.h>
+#include <cstddef>  // size_t
+#include <cstdint>  // int64_t, uint64_t
+#include <vector>
+
+
+// parallel_for_each over coro_sequence, against iterating it on a single thread
+//
+//   - serial: f runs on the iterating thread, element by element
+//   - ordered and unordered: f runs in batches of 256 elements, on the executor's threads, with the results collected
+//     in the order of the elements, or in the order the batches complete
+// The work per element is a loop of range(1) dependent multiplications, so that zero measures the batching overhead,
+// and bigger amounts show how far the batches spread over the threads
+
+namespace {
+    using namespace rtc::coro;
+    using namespace rtc::coro::mpp_mcpp::v4d;
+    using namespace rtc::coro::pipeline;
+
+    struct work {
+        int amount;
+
+        std::uint64_t operator()(int i) const noexcept {
+            auto x{ static_cast<std::uint64_t>(i) };
+            for (int n{ 0 }; n < amount; ++n) {
+                x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            }
+            return x;
+        }
+    };
+
+    void BM_serial(benchmark::State& state) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        const work f{ static_cast<int>(state.range(1)) };
+        for (auto _ : state) {
+            std::vector<std::uint64_t> results;
+            results.reserve(n);
+            for (auto i : coro_sequence() | take(n)) {
+                results.push_back(f(i));
+            }
+            benchmark::DoNotOptimize(results.data());
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+    }
+
+    void run_parallel(benchmark::State& state, result_order order) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        const work f{ static_cast<int>(state.range(1)) };
+        for (auto _ : state) {
+            auto results{ parallel_for_each(coro_sequence() | take(n), f, { .order = order }).get_result() };
+            benchmark::DoNotOptimize(results.data());
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+    }
+
+    void BM_parallel_ordered(benchmark::State& state) {
+        run_parallel(state, result_order::ordered);
+    }
+
+    void BM_parallel_unordered(benchmark::State& state) {
+        run_parallel(state, result_order::unordered);
+    }
+}  // namespace
+
+BENCHMARK(BM_serial)->ArgsProduct({ { 100'000 }, { 0, 64, 512 } });
+BENCHMARK(BM_parallel_ordered)->ArgsProduct({ { 100'000 }, { 0, 64, 512 } })->UseRealTime();
+BENCHMARK(BM_parallel_unordered)->ArgsProduct({ { 100'000 }, { 0, 64, 512 } })->UseRealTime();
@@ -0,0 +1,127 @@
+#include "pipeline.h"
+
+#include <benchmark/benchmark.h>
+#include <cstddef>  // size_t
+#include <generator.hpp>
+#include <ranges>  // elements_of, views::transform
+
+
+// Stages over std::generator
+// Every stage written as a generator adds a frame and a resume per element; nesting with elements_of
+// adds one level of delegation per generator; fused pipeline stages run inside the frame of a single generator
+
+namespace {
+    std::generator<int> sequence(int n) {
+        for (int i{ 0 }; i < n; ++i) {
+            co_yield i;
+        }
+    }
+
+    // Function objects rather than functions, so that stages don't call through a function pointer
+    constexpr auto is_even{ [](int i) noexcept { return i % 2 == 0; } };
+    constexpr auto square{ [](int i) noexcept { return i * i; } };
+
+    void BM_views_transform(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : sequence(n) | std::views::transform(square)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    // Every level delegates to the one below it with elements_of
+    std::generator<int> nested(int depth, int n) {
+        if (depth == 0) {
+            for (int i{ 0 }; i < n; ++i) {
+                co_yield i;
+            }
+        } else {
+            co_yield std::ranges::elements_of(nested(depth - 1, n));
+        }
+    }
+
+    void BM_nested_elements_of(benchmark::State& state) {
+        const auto depth{ static_cast<int>(state.range(0)) };
+        const auto n{ static_cast<int>(state.range(1)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : nested(depth, n)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    // filter, map, and take, one generator each
+    std::generator<int> filter_even(std::generator<int> g) {
+        for (auto i : g) {
+            if (is_even(i)) {
+                co_yield i;
+            }
+        }
+    }
+    std::generator<int> map_square(std::generator<int> g) {
+        for (auto i : g) {
+            co_yield square(i);
+        }
+    }
+    std::generator<int> take_n(std::generator<int> g, std::size_t n) {
+        for (auto i : g) {
+            if (n-- == 0) {
+                break;
+            }
+            co_yield i;
+        }
+    }
+
+    void BM_stacked_generators(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : take_n(map_square(filter_even(sequence(n))), n / 4)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n / 2);
+    }
+
+    void BM_fused_pipeline(benchmark::State& state) {
+        using namespace rtc::coro::pipeline;
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto i : sequence(n) | filter(is_even) | map(square) | take(n / 4)) {
+                sum += i;
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n / 2);
+    }
+
+    void BM_fused_pipeline_chunks(benchmark::State& state) {
+        using namespace rtc::coro::pipeline;
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            int sum{ 0 };
+            for (auto c : sequence(n) | filter(is_even) | map(square) | take(n / 4) | chunk<64>()) {
+                for (auto i : c) {
+                    sum += i;
+                }
+            }
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * n / 2);
+    }
+}  // namespace
+
+BENCHMARK(BM_views_transform)->Arg(1024);
+BENCHMARK(BM_nested_elements_of)->ArgsProduct({ { 1, 2, 4, 8 }, { 1024 } });
+BENCHMARK(BM_stacked_generators)->Arg(1024);
+BENCHMARK(BM_fused_pipeline)->Arg(1024);
+BENCHMARK(BM_fused_pipeline_chunks)->Arg(1024);
@@ -0,0 +1,351 @@
+#include "MPP_MCpp/v4d/async_mutex.h"
+#include "MPP_MCpp/v4d/async_semaphore.h"
+#include "MPP_MCpp/v4d/channel.h"
+#include "MPP_MCpp/v4d/ctask.h"
+#include "MPP_MCpp/v4d/task.h"
+#include "MPP_MCpp/v4d/task_scope.h"
+#include "MPP_MCpp/v4d/when_all.h"
+
+#include <benchmark/benchmark.h>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <cstdint>  // int64_t
+#include <mutex>  // lock_guard
+#include <semaphore>  // counting_semaphore
+#include <vector>
+
+
+// Coroutine create/resume/complete costs
+//
+//   - frame creation: creating and destroying a lazy task that never runs
+//   - resume: resuming a coroutine that suspends again right away
+//   - co_await on a lazy task, that runs inline
+//   - co_await on a ready ctask, and on a not-ready ctask, which goes through the executor
+//   - continuation fan-out: completing a task that has N continuations registered
+//   - children: a parent running N child tasks, with shared states and when_all, or spawned in a task scope
+//   - contended co_await: N tasks co_awaiting one task, registering while it runs, and resumed when it completes
+//   - contended locks: N tasks incrementing a counter under an async_mutex, against a std::mutex, which blocks
+//     the executor thread instead of suspending the task; and N tasks taking one of two permits of an async_semaphore,
+//     against a std::counting_semaphore
+//   - channel: N producers sending values through a channel of capacity 64 to N consumers
+
+namespace {
+    using namespace rtc::coro::mpp_mcpp::v4d;
+
+    // Coroutine that starts right away and destroys itself when it finishes, for driving awaits from a benchmark loop
+    struct detached {
+        struct promise_type {
+            detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {}
+        };
+    };
+
+    // Coroutine that suspends every time it is resumed, and never finishes
+    struct looping {
+        struct promise_type {
+            looping get_return_object() noexcept {
+                return looping{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {}
+        };
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // Executor that resumes the continuations right away, so fan-out is measured without thread hops
+    class inline_executor final : public executor_interface {
+    public:
+        void schedule(work_item item) override {
+            item.execute();
+        }
+    };
+
+    task<int> lazy_value(int i) {
+        co_return i;
+    }
+
+    ctask<int> eager_value(int i) {
+        co_return i;
+    }
+
+    ctask<int> eager_await(int i) {
+        co_return co_await eager_value(i);
+    }
+
+    ctask<int> shared_children(int n) {
+        std::vector<ctask<int>> children;
+        children.reserve(n);
+        for (int i{ 0 }; i < n; ++i) {
+            children.push_back(eager_value(i));
+        }
+        auto values{ co_await when_all(std::move(children)) };
+        co_return static_cast<int>(values.size());
+    }
+
+    ctask<int> scoped_children(int n) {
+        task_scope scope;
+        std::vector<ctask<int>> children;
+        children.reserve(n);
+        for (int i{ 0 }; i < n; ++i) {
+            children.push_back(scope.spawn(eager_value, i));
+        }
+        co_await scope.join();
+        co_return static_cast<int>(children.size());
+    }
+
+    // Keeps an executor thread busy for a while, so that the awaiters register while it runs
+    ctask<int> spinning_value(int spins) {
+        for (int i{ 0 }; i < spins; ++i) {
+            benchmark::DoNotOptimize(i);
+        }
+        co_return spins;
+    }
+
+    ctask<int> contended_await(ctask<int> t) {
+        co_return co_await t;
+    }
+
+    constexpr int operations_per_task = 1'000;
+
+    ctask<void> async_mutex_increments(async_mutex& mutex, std::int64_t& counter) {
+        for (int i{ 0 }; i < operations_per_task; ++i) {
+            auto lock{ co_await mutex.scoped_lock() };
+            ++counter;
+        }
+    }
+
+    ctask<void> std_mutex_increments(std::mutex& mutex, std::int64_t& counter) {
+        for (int i{ 0 }; i < operations_per_task; ++i) {
+            std::lock_guard lock{ mutex };
+            ++counter;
+        }
+        co_return;
+    }
+
+    ctask<void> async_semaphore_acquires(async_semaphore& semaphore) {
+        for (int i{ 0 }; i < operations_per_task; ++i) {
+            co_await semaphore.acquire();
+            semaphore.release();
+        }
+    }
+
+    ctask<void> std_semaphore_acquires(std::counting_semaphore<>& semaphore) {
+        for (int i{ 0 }; i < operations_per_task; ++i) {
+            semaphore.acquire();
+            semaphore.release();
+        }
+        co_return;
+    }
+
+    ctask<void> send_values(channel<int>& values) {
+        for (int i{ 0 }; i < operations_per_task; ++i) {
+            co_await values.send(int{ i });
+        }
+    }
+
+    ctask<std::int64_t> receive_values(channel<int>& values) {
+        std::int64_t sum{};
+        while (true) {
+            auto value{ co_await values.receive() };
+            if (not value) {
+                co_return sum;
+            }
+            sum += *value;
+        }
+    }
+
+    looping loop() {
+        for (;;) {
+            co_await std::suspend_always{};
+        }
+    }
+
+    detached await_lazy(int i, int& out) {
+        out = co_await lazy_value(i);
+    }
+
+    detached await_ready_ctask(const ctask<int>& t, int& out) {
+        out = co_await t;
+    }
+
+
+    void BM_frame_creation(benchmark::State& state) {
+        for (auto _ : state) {
+            auto t{ lazy_value(1) };
+            benchmark::DoNotOptimize(t);
+        }
+    }
+
+    void BM_resume(benchmark::State& state) {
+        auto l{ loop() };
+        for (auto _ : state) {
+            l.handle_.resume();
+        }
+        l.handle_.destroy();
+    }
+
+    void BM_lazy_task_co_await(benchmark::State& state) {
+        int out{};
+        for (auto _ : state) {
+            await_lazy(1, out);
+            benchmark::DoNotOptimize(out);
+        }
+    }
+
+    void BM_ctask_co_await_ready(benchmark::State& state) {
+        auto t{ eager_value(1) };
+        t.wait();
+        int out{};
+        for (auto _ : state) {
+            await_ready_ctask(t, out);
+            benchmark::DoNotOptimize(out);
+        }
+    }
+
+    void BM_ctask_co_await_not_ready(benchmark::State& state) {
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(eager_await(1).get_result());
+        }
+    }
+
+    void BM_continuation_fan_out(benchmark::State& state) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        inline_executor executor{};
+        std::vector<looping> awaiters;
+        std::vector<continuation> continuations(n);
+        for (std::size_t i{ 0 }; i < n; ++i) {
+            awaiters.push_back(loop());
+            continuations[i].handle_ = awaiters[i].handle_;
+            continuations[i].executor_ = &executor;
+        }
+        for (auto _ : state) {
+            continuation_manager manager{};
+            for (auto& c : continuations) {
+                manager.register_continuation(c);
+            }
+            manager.resume_all_continuations(continuation_manager::completion::value, continuation_policy::reschedule);
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+        for (auto& a : awaiters) {
+            a.handle_.destroy();
+        }
+    }
+
+    void BM_shared_children(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(shared_children(n).get_result());
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    void BM_scoped_children(benchmark::State& state) {
+        const auto n{ static_cast<int>(state.range(0)) };
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(scoped_children(n).get_result());
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    void BM_contended_co_await(benchmark::State& state) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        std::vector<ctask<int>> awaiters;
+        awaiters.reserve(n);
+        for (auto _ : state) {
+            auto source{ spinning_value(1'000) };
+            for (std::size_t i{ 0 }; i < n; ++i) {
+                awaiters.push_back(contended_await(source));
+            }
+            for (auto& a : awaiters) {
+                benchmark::DoNotOptimize(a.get_result());
+            }
+            awaiters.clear();
+        }
+        state.SetItemsProcessed(state.iterations() * n);
+    }
+
+    // Runs n tasks made by make_task, and waits for them all
+    template <typename make_task_t>
+    void run_contended(benchmark::State& state, make_task_t make_task) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        std::vector<ctask<void>> tasks;
+        tasks.reserve(n);
+        for (auto _ : state) {
+            for (std::size_t i{ 0 }; i < n; ++i) {
+                tasks.push_back(make_task());
+            }
+            for (auto& t : tasks) {
+                t.get_result();
+            }
+            tasks.clear();
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n) * operations_per_task);
+    }
+
+    void BM_async_mutex_contended(benchmark::State& state) {
+        async_mutex mutex;
+        std::int64_t counter{};
+        run_contended(state, [&]() { return async_mutex_increments(mutex, counter); });
+        benchmark::DoNotOptimize(counter);
+    }
+
+    void BM_std_mutex_contended(benchmark::State& state) {
+        std::mutex mutex;
+        std::int64_t counter{};
+        run_contended(state, [&]() { return std_mutex_increments(mutex, counter); });
+        benchmark::DoNotOptimize(counter);
+    }
+
+    void BM_async_semaphore_contended(benchmark::State& state) {
+        async_semaphore semaphore{ 2 };
+        run_contended(state, [&]() { return async_semaphore_acquires(semaphore); });
+    }
+
+    void BM_std_semaphore_contended(benchmark::State& state) {
+        std::counting_semaphore<> semaphore{ 2 };
+        run_contended(state, [&]() { return std_semaphore_acquires(semaphore); });
+    }
+
+    void BM_channel(benchmark::State& state) {
+        const auto n{ static_cast<std::size_t>(state.range(0)) };
+        std::vector<ctask<void>> producers;
+        std::vector<ctask<std::int64_t>> consumers;
+        for (auto _ : state) {
+            channel<int> values{ 64 };
+            for (std::size_t i{ 0 }; i < n; ++i) {
+                consumers.push_back(receive_values(values));
+                producers.push_back(send_values(values));
+            }
+            for (auto& p : producers) {
+                p.get_result();
+            }
+            values.close();
+            for (auto& c : consumers) {
+                benchmark::DoNotOptimize(c.get_result());
+            }
+            producers.clear();
+            consumers.clear();
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n) * operations_per_task);
+    }
+}  // namespace
+
+BENCHMARK(BM_frame_creation);
+BENCHMARK(BM_resume);
+BENCHMARK(BM_lazy_task_co_await);
+BENCHMARK(BM_ctask_co_await_ready);
+BENCHMARK(BM_ctask_co_await_not_ready)->UseRealTime();
+BENCHMARK(BM_continuation_fan_out)->RangeMultiplier(8)->Range(1, 512);
+BENCHMARK(BM_shared_children)->RangeMultiplier(8)->Range(1, 512)->UseRealTime();
+BENCHMARK(BM_scoped_children)->RangeMultiplier(8)->Range(1, 512)->UseRealTime();
+BENCHMARK(BM_contended_co_await)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_async_mutex_contended)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_std_mutex_contended)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_async_semaphore_contended)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_std_semaphore_contended)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
+BENCHMARK(BM_channel)->RangeMultiplier(4)->Range(1, 64)->UseRealTime();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "trace.h"
+
 #include <algorithm>  // for_each
 #include <cassert>
 #include <chrono>
@@ -54,10 +56,14 @@
 
 namespace rtc::coro::mpp_mcpp::v4b {
     // Debug print helper
+    // Compiles to nothing, prints, or records into a ring buffer, depending on the trace mode (see trace.h)
     inline void debug_print(std::string_view text) {
-        static std::mutex mtx;
-        std::lock_guard lock{ mtx };
-        fmt::print("\t[{}]\n", text);
+        if constexpr (trace::mode == trace::mode_type::print) {
+            std::lock_guard lock{ trace::print_mutex() };
+            fmt::print("\t[{}]\n", text);
+        } else if constexpr (trace::mode == trace::mode_type::ring_buffer) {
+            trace::record("", text);
+        }
     }
 
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "trace.h"
+
 #include <algorithm>  // for_each
 #include <cassert>
 #include <chrono>
@@ -66,10 +68,14 @@
 
 namespace rtc::coro::mpp_mcpp::v4c {
     // Debug print helper
+    // Compiles to nothing, prints, or records into a ring buffer, depending on the trace mode (see trace.h)
     inline void debug_print(std::string_view name, std::string_view text) {
-        static std::mutex mtx;
-        std::lock_guard lock{ mtx };
-        fmt::print("\t{} [{}]\n", name, text);
+        if constexpr (trace::mode == trace::mode_type::print) {
+            std::lock_guard lock{ trace::print_mutex() };
+            fmt::print("\t{} [{}]\n", name, text);
+        } else if constexpr (trace::mode == trace::mode_type::ring_buffer) {
+            trace::record(name, text);
+        }
     }
 
 
@@ -248,7 +254,10 @@ namespace rtc::coro::mpp_mcpp::v4c {
     private:
         std::weak_ptr<state> shared_state_;
         void debug(std::string_view text) {
-            debug_print(get_state()->name_, text);
+            // Don't even lock the state if tracing is off
+            if constexpr (trace::enabled) {
+                debug_print(get_state()->name_, text);
+            }
         }
     public:
         auto get_return_object() {
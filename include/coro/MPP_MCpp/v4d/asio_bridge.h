@@ -0,0 +1,199 @@
+#pragma once
+
+#include "ctask.h"
+#include "executor.h"
+#include "waiter.h"
+
+#include <asio.hpp>
+#include <coroutine>
+#include <exception>  // exception_ptr, rethrow_exception
+#include <memory>  // make_shared, shared_ptr, unique_ptr
+#include <optional>
+#include <type_traits>  // conditional_t, is_void_v
+#include <utility>  // forward, move
+#include <variant>  // monostate
+
+
+// asio bridge
+//
+// Lets ctasks and asio coroutines share one scheduler, without blocking calls or thread hops of their own:
+//
+//   - asio_executor: a ctask executor that posts onto an asio executor, e.g. an io_context's, or a strand,
+//     so a ctask, and its continuations, can run on an io thread
+//   - as_awaitable(task), or async_wait(task, token): an asio::awaitable, or any asio async operation, that completes
+//     on the asio side once a ctask has completed, so an io thread never blocks on get_result
+//   - on_asio(executor, awaitable): runs an asio::awaitable, e.g. an async read, on an asio executor, and resumes
+//     the ctask awaiting it back on the ctask's own executor
+//
+// E.g. a request handler that offloads CPU work, and comes back to its io thread:
+//   asio::awaitable<void> handle(asio::ip::tcp::socket& socket, request r) {
+//       auto response{ co_await as_awaitable(compute(std::move(r))) };  // compute is a ctask on the thread pool
+//       co_await asio::async_write(socket, response.buffer(), asio::use_awaitable);
+//   }
+//
+// And a ctask running on an io_context strand:
+//   asio_executor<asio::strand<asio::io_context::executor_type>> strand{ asio::make_strand(io_ctx) };
+//   auto t{ session(executor_arg, strand, ...) };
+//
+// Notes on implementation:
+//
+//   - asio_executor posts every work item as a small function object; it keeps executor metrics, in a shard per
+//     io thread running its items, and per thread scheduling on it
+//     The function object shares the metrics rather than pointing back at the executor, so items still queued
+//     when the executor is destroyed run safely; the tasks they resume must not schedule on it anymore, though
+//   - async_wait registers a continuation with an on_ready hook, which posts the completion handler to the handler's
+//     associated executor; a work guard keeps that executor's io_context running in the meantime
+//   - on_asio co_spawns the awaitable, and its completion handler resumes the ctask as a waiter (see waiter.h);
+//     asio::co_spawn needs the awaitable's result to be default constructible
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    // asio executor
+    // A ctask executor on top of an asio executor
+    //
+    template <typename asio_executor_t = asio::io_context::executor_type>
+    class asio_executor final : public executor_interface {
+    public:
+        explicit asio_executor(asio_executor_t executor)
+            : executor_{ std::move(executor) } {
+            metrics_ = own_metrics_.get();
+        }
+        void schedule(work_item item) override {
+            own_metrics_->scheduled(item);
+            asio::post(executor_, [metrics = own_metrics_, item = std::move(item)]() mutable {
+                metrics->execute(item);
+            });
+        }
+        const asio_executor_t& get_asio_executor() const noexcept {
+            return executor_;
+        }
+    private:
+        asio_executor_t executor_;
+        std::shared_ptr<executor_metrics> own_metrics_{ std::make_shared<executor_metrics>() };
+    };
+
+
+    // Wait for a ctask from asio
+    // Completion signature void(), never with an error: the task's result, or its exception, is then at hand
+    // with get_result, which won't block
+    //
+    template <is_task task_t, typename handler_t>
+    class ctask_wait_operation : public continuation {
+    public:
+        static void start(task_t task, handler_t handler) {
+            std::unique_ptr<ctask_wait_operation> op{ new ctask_wait_operation{ std::move(task), std::move(handler) } };
+            if (op->task_.register_continuation(*op)) {
+                op.release();  // owned by the continuation until the task completes
+            } else {
+                complete(std::move(op));
+            }
+        }
+    private:
+        ctask_wait_operation(task_t task, handler_t handler)
+            : task_{ std::move(task) }
+            , handler_{ std::move(handler) }
+            , work_{ asio::make_work_guard(asio::get_associated_executor(handler_)) } {
+            on_ready_ = &ctask_wait_operation::on_ready;
+        }
+        static std::coroutine_handle<> on_ready(continuation& c) noexcept {
+            complete(std::unique_ptr<ctask_wait_operation>{ static_cast<ctask_wait_operation*>(&c) });
+            return nullptr;
+        }
+        static void complete(std::unique_ptr<ctask_wait_operation> op) noexcept {
+            auto executor{ op->work_.get_executor() };
+            asio::post(executor, [op = std::move(op)]() mutable {
+                auto handler{ std::move(op->handler_) };
+                op.reset();
+                std::move(handler)();
+            });
+        }
+
+        task_t task_;
+        handler_t handler_;
+        asio::executor_work_guard<asio::associated_executor_t<handler_t>> work_;
+    };
+
+    template <is_task task_t, typename token_t>
+    auto async_wait(task_t task, token_t&& token) {
+        return asio::async_initiate<token_t, void()>(
+            [](auto handler, task_t task) {
+                ctask_wait_operation<task_t, decltype(handler)>::start(std::move(task), std::move(handler));
+            },
+            token, std::move(task));
+    }
+
+    // co_await as_awaitable(task) returns the task's result, or rethrows its exception, on the asio side
+    template <is_task task_t>
+    asio::awaitable<typename task_t::result_type> as_awaitable(task_t task) {
+        co_await async_wait(task, asio::use_awaitable);
+        if constexpr (std::is_void_v<typename task_t::result_type>) {
+            task.get_result();
+        } else {
+            co_return task.get_result();
+        }
+    }
+
+
+    // Wait for asio from a ctask
+    // co_await on_asio(executor, awaitable) runs the awaitable on the asio executor, and returns its result,
+    // or rethrows its exception, once the ctask is resumed on its own executor
+    //
+    template <typename result_t, typename asio_executor_t>
+    class asio_awaitable {
+        class awaiter {
+        public:
+            awaiter(asio_executor_t executor, asio::awaitable<result_t> awaitable)
+                : executor_{ std::move(executor) }
+                , awaitable_{ std::move(awaitable) }
+            {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            template <typename promise_t>
+            void await_suspend(std::coroutine_handle<promise_t> handle) {
+                prepare_waiter(waiter_, handle);
+                asio::co_spawn(executor_, std::move(awaitable_), [this](std::exception_ptr exception, auto&&... value) {
+                    exception_ = std::move(exception);
+                    if constexpr (sizeof...(value) != 0) {
+                        if (not exception_) {
+                            value_.emplace(std::forward<decltype(value)>(value)...);
+                        }
+                    }
+                    resume_waiter(waiter_);
+                });
+            }
+            result_t await_resume() {
+                if (exception_) {
+                    std::rethrow_exception(exception_);
+                }
+                if constexpr (not std::is_void_v<result_t>) {
+                    return std::move(*value_);
+                }
+            }
+        private:
+            using value_type = std::conditional_t<std::is_void_v<result_t>, std::monostate, result_t>;
+
+            asio_executor_t executor_;
+            asio::awaitable<result_t> awaitable_;
+            continuation waiter_{};
+            std::exception_ptr exception_;
+            std::optional<value_type> value_;
+        };
+    public:
+        asio_awaitable(asio_executor_t executor, asio::awaitable<result_t> awaitable)
+            : executor_{ std::move(executor) }
+            , awaitable_{ std::move(awaitable) }
+        {}
+        auto operator co_await() && {
+            return awaiter{ std::move(executor_), std::move(awaitable_) };
+        }
+    private:
+        asio_executor_t executor_;
+        asio::awaitable<result_t> awaitable_;
+    };
+
+    template <typename asio_executor_t, typename result_t>
+    auto on_asio(asio_executor_t executor, asio::awaitable<result_t> awaitable) {
+        return asio_awaitable<result_t, asio_executor_t>{ std::move(executor), std::move(awaitable) };
+    }
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "waiter.h"
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>  // uintptr_t
+#include <mutex>  // adopt_lock, adopt_lock_t
+#include <utility>  // exchange
+
+
+// Async mutex
+//
+// A mutex whose lock is co_awaited: a contended lock suspends the coroutine, instead of blocking its executor thread,
+// and unlock resumes the next waiter, on its executor, already owning the mutex
+//
+// E.g.
+//   ctask<void> add(async_mutex& mutex, std::vector<int>& values, int value) {
+//       auto lock{ co_await mutex.scoped_lock() };
+//       values.push_back(value);
+//   }
+//
+// Notes on implementation:
+//
+//   - Lock-free: a single atomic state word is either
+//       - not-locked,
+//       - locked-no-waiters, or
+//       - a pointer to the most recently suspended waiter, which links to the older ones
+//   - Locking is a CAS from not-locked, and waiting is a CAS that pushes the awaiter's continuation onto the state word
+//   - Only the owner pops waiters: unlock moves the pushed ones, oldest first, to a FIFO list only the owner touches,
+//     so waiters get the mutex in the order they suspended, and it is handed over to them without ever being released
+//   - Unlocking without waiters is a single CAS back to not-locked
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    class async_mutex;
+
+
+    // Scoped lock
+    // Owns a locked async mutex, and unlocks it when destroyed
+    class async_mutex_lock {
+    public:
+        async_mutex_lock(async_mutex& mutex, std::adopt_lock_t) noexcept
+            : mutex_{ &mutex }
+        {}
+        async_mutex_lock(async_mutex_lock&& other) noexcept
+            : mutex_{ std::exchange(other.mutex_, nullptr) }
+        {}
+        async_mutex_lock(const async_mutex_lock&) = delete;
+        async_mutex_lock& operator=(const async_mutex_lock&) = delete;
+        async_mutex_lock& operator=(async_mutex_lock&&) = delete;
+        inline ~async_mutex_lock();
+    private:
+        async_mutex* mutex_;
+    };
+
+
+    class async_mutex {
+    public:
+        async_mutex() = default;
+        async_mutex(const async_mutex&) = delete;
+        async_mutex& operator=(const async_mutex&) = delete;
+        ~async_mutex() {
+            assert(state_.load(std::memory_order_relaxed) == not_locked);
+        }
+
+        bool try_lock() noexcept {
+            auto expected{ not_locked };
+            return state_.compare_exchange_strong(expected, locked_no_waiters,
+                std::memory_order_acquire, std::memory_order_relaxed);
+        }
+        // co_await lock() returns once the mutex is owned, and then the coroutine has to unlock it
+        auto lock() noexcept {
+            return lock_awaitable<false>{ *this };
+        }
+        // co_await scoped_lock() returns an async_mutex_lock, which unlocks the mutex when destroyed
+        auto scoped_lock() noexcept {
+            return lock_awaitable<true>{ *this };
+        }
+        // Hands the mutex over to the oldest waiter, if any
+        void unlock() {
+            assert(state_.load(std::memory_order_relaxed) != not_locked);
+            auto head{ waiters_ };
+            if (head == nullptr) {
+                auto expected{ locked_no_waiters };
+                if (state_.compare_exchange_strong(expected, not_locked,
+                        std::memory_order_release, std::memory_order_relaxed)) {
+                    return;
+                }
+                // Take the waiters pushed since, and reverse them, so that the oldest comes first
+                auto pushed{ reinterpret_cast<continuation*>(state_.exchange(locked_no_waiters, std::memory_order_acquire)) };
+                while (pushed != nullptr) {
+                    auto next{ pushed->next_ };
+                    pushed->next_ = head;
+                    head = pushed;
+                    pushed = next;
+                }
+            }
+            waiters_ = head->next_;
+            resume_waiter(*head);
+        }
+    private:
+        static constexpr std::uintptr_t locked_no_waiters = 0;
+        static constexpr std::uintptr_t not_locked = 1;
+
+        static_assert(alignof(continuation) > not_locked);
+
+        template <bool scoped>
+        class lock_awaiter {
+        public:
+            explicit lock_awaiter(async_mutex& mutex) noexcept
+                : mutex_{ &mutex }
+            {}
+            bool await_ready() noexcept {
+                return mutex_->try_lock();
+            }
+            // Returns false if the mutex was unlocked in the meantime, and then it is owned already
+            template <typename promise_t>
+            bool await_suspend(std::coroutine_handle<promise_t> handle) noexcept {
+                prepare_waiter(waiter_, handle);
+                auto state{ mutex_->state_.load(std::memory_order_relaxed) };
+                while (true) {
+                    if (state == not_locked) {
+                        if (mutex_->state_.compare_exchange_weak(state, locked_no_waiters,
+                                std::memory_order_acquire, std::memory_order_relaxed)) {
+                            return false;
+                        }
+                    } else {
+                        waiter_.next_ = reinterpret_cast<continuation*>(state);
+                        if (mutex_->state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(&waiter_),
+                                std::memory_order_release, std::memory_order_relaxed)) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            auto await_resume() const noexcept {
+                if constexpr (scoped) {
+                    return async_mutex_lock{ *mutex_, std::adopt_lock };
+                }
+            }
+        private:
+            async_mutex* mutex_;
+            continuation waiter_{};
+        };
+
+        template <bool scoped>
+        class lock_awaitable {
+        public:
+            explicit lock_awaitable(async_mutex& mutex) noexcept
+                : mutex_{ &mutex }
+            {}
+            auto operator co_await() const noexcept {
+                return lock_awaiter<scoped>{ *mutex_ };
+            }
+        private:
+            async_mutex* mutex_;
+        };
+
+        std::atomic<std::uintptr_t> state_{ not_locked };
+        continuation* waiters_{};  // only touched by the owner
+    };
+
+
+    inline async_mutex_lock::~async_mutex_lock() {
+        if (mutex_) {
+            mutex_->unlock();
+        }
+    }
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "waiter.h"
+
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <mutex>  // lock_guard
+
+
+// Async semaphore
+//
+// A counting semaphore whose acquire is co_awaited: without permits, the coroutine suspends, instead of blocking its
+// executor thread, and release resumes the oldest waiters, on their executors, each with a permit
+//
+// E.g.
+//   async_semaphore connections{ 64 };
+//   ctask<void> fetch(request r) {
+//       co_await connections.acquire();
+//       ...
+//       connections.release();
+//   }
+//
+// Notes on implementation:
+//
+//   - The permits and the waiter queue are kept under a std::mutex, held for a few instructions, and never across
+//     a suspension: waiters are only resumed once it has been released
+//   - Released permits go to the waiters first, so a waiter can't be overtaken by a coroutine that comes later
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    class async_semaphore {
+    public:
+        explicit async_semaphore(size_t permits) noexcept
+            : permits_{ permits }
+        {}
+        async_semaphore(const async_semaphore&) = delete;
+        async_semaphore& operator=(const async_semaphore&) = delete;
+
+        bool try_acquire() noexcept {
+            std::lock_guard lock{ mutex_ };
+            if (permits_ == 0) {
+                return false;
+            }
+            --permits_;
+            return true;
+        }
+        // co_await acquire() returns once the coroutine has a permit
+        auto acquire() noexcept {
+            return acquire_awaitable{ *this };
+        }
+        void release(size_t permits = 1) {
+            waiter_queue woken;
+            {
+                std::lock_guard lock{ mutex_ };
+                for (; permits > 0 && not waiters_.empty(); --permits) {
+                    woken.push_back(*waiters_.pop_front());
+                }
+                permits_ += permits;
+            }
+            resume_waiters(woken.take_all());
+        }
+    private:
+        class acquire_awaiter {
+        public:
+            explicit acquire_awaiter(async_semaphore& semaphore) noexcept
+                : semaphore_{ &semaphore }
+            {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            // Returns false if there was a permit, and then it is taken
+            template <typename promise_t>
+            bool await_suspend(std::coroutine_handle<promise_t> handle) {
+                prepare_waiter(waiter_, handle);
+                std::lock_guard lock{ semaphore_->mutex_ };
+                if (semaphore_->permits_ > 0) {
+                    --semaphore_->permits_;
+                    return false;
+                }
+                semaphore_->waiters_.push_back(waiter_);
+                return true;
+            }
+            void await_resume() const noexcept {}
+        private:
+            async_semaphore* semaphore_;
+            continuation waiter_{};
+        };
+
+        class acquire_awaitable {
+        public:
+            explicit acquire_awaitable(async_semaphore& semaphore) noexcept
+                : semaphore_{ &semaphore }
+            {}
+            auto operator co_await() const noexcept {
+                return acquire_awaiter{ *semaphore_ };
+            }
+        private:
+            async_semaphore* semaphore_;
+        };
+
+        std::mutex mutex_;
+        size_t permits_;
+        waiter_queue waiters_;
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>  // enable_shared_from_this, shared_ptr
+#include <optional>
+#include <stop_token>  // stop_callback, stop_token
+#include <utility>  // move
+
+
+// Cancellation
+//
+// Cooperative: a ctask whose stop has been requested, or one of whose ancestors has, is
+//   - skipped when it is dequeued, i.e. its body never runs, and
+//   - interrupted whenever it is resumed after co_awaiting another task,
+// and in both cases it completes with a task_cancelled exception, which get_result rethrows
+// Long computations can check for themselves with co_await cancelled()
+//
+// E.g.
+//   auto t{ mul_add(16, 4, 13, 1) };
+//   t.request_stop();  // mul_add, and both of its muls, if they haven't started yet, don't run
+//
+//   auto stop{ co_await cancelled() };
+//   if (stop) { co_return partial_result; }
+//
+// GCC 12 miscompiles a co_await directly in an if condition followed by a co_return, e.g.
+// if (co_await cancelled()) co_return; so the result is bound to a variable first
+//
+// Notes on implementation:
+//
+//   - Every task's state is a cancellation node; a task created in the body of another ctask links to the node
+//     of that task, its parent, which it keeps alive
+//   - A stop request is a flag in the node; checking for one walks up the chain of parents, without locking,
+//     and without touching any reference count
+//   - A task can also observe a std::stop_token, e.g. the executor's, or a request's: co_await token, in its body
+//     The node registers a stop callback on the token that sets its flag, so the checks, which may run on any thread,
+//     only ever read that atomic flag, and never the token, which the task's own thread writes
+//   - The current node is a thread local pointer, set when a ctask body runs or is resumed,
+//     and reset by the executor once the work item is done
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    class task_cancelled : public std::exception {
+    public:
+        const char* what() const noexcept override {
+            return "task cancelled";
+        }
+    };
+
+
+    // Cancellation node
+    class cancellation_node : public std::enable_shared_from_this<cancellation_node> {
+    public:
+        void request_stop() noexcept {
+            stop_requested_.store(true, std::memory_order_release);
+        }
+        bool stop_requested() const noexcept {
+            for (auto node{ this }; node != nullptr; node = node->parent_.get()) {
+                if (node->stop_requested_.load(std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        void set_parent(std::shared_ptr<const cancellation_node> parent) noexcept {
+            parent_ = std::move(parent);
+        }
+        // Replaces the token observed so far, if any; a stop already requested on it stays requested
+        void set_stop_token(std::stop_token token) noexcept {
+            stop_callback_.emplace(std::move(token), request_stop_callback{ this });
+        }
+
+        // Node of the ctask whose body is running on this thread, if any
+        static cancellation_node*& current() noexcept {
+            static thread_local cancellation_node* node{};
+            return node;
+        }
+    private:
+        struct request_stop_callback {
+            cancellation_node* node;
+
+            void operator()() const noexcept {
+                node->request_stop();
+            }
+        };
+
+        std::atomic<bool> stop_requested_{};
+        std::shared_ptr<const cancellation_node> parent_;
+        std::optional<std::stop_callback<request_stop_callback>> stop_callback_;  // last, so it's deregistered first
+    };
+
+
+    // Check point
+    // co_await cancelled() returns whether the task's stop has been requested
+    struct cancelled_t {};
+
+    inline cancelled_t cancelled() noexcept {
+        return {};
+    }
+
+    class cancelled_awaiter {
+    public:
+        explicit cancelled_awaiter(const cancellation_node& node) noexcept
+            : node_{ &node }
+        {}
+        bool await_ready() const noexcept {
+            return true;
+        }
+        void await_suspend(std::coroutine_handle<>) const noexcept {}
+        bool await_resume() const noexcept {
+            return node_->stop_requested();
+        }
+    private:
+        const cancellation_node* node_;
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
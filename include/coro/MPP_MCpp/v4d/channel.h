@@ -0,0 +1,237 @@
+#pragma once
+
+#include "waiter.h"
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <mutex>  // lock_guard
+#include <optional>
+#include <utility>  // move
+#include <vector>
+
+
+// Channel
+//
+// Bounded multi-producer, multi-consumer queue of values between coroutines
+// A send to a full channel, and a receive from an empty one, suspend the coroutine, instead of blocking its executor
+// thread, until a receive, or a send, resumes it, on its executor
+//
+// E.g.
+//   channel<request> requests{ 128 };
+//   ctask<void> produce() {
+//       for (auto r : read_requests()) {
+//           co_await requests.send(std::move(r));
+//       }
+//       requests.close();
+//   }
+//   ctask<void> consume() {
+//       while (auto r{ co_await requests.receive() }) {
+//           handle(*r);
+//       }
+//   }
+//
+// co_await send(value) returns false if the channel is closed, and then the value is dropped
+// co_await receive() returns an empty optional once the channel is closed and drained
+//
+// Notes on implementation:
+//
+//   - The buffer, a ring of capacity values, and the queues of waiting senders and receivers are kept under
+//     a std::mutex, held for a few instructions, and never across a suspension: waiters are only resumed once it has
+//     been released
+//   - A value sent while a receiver waits goes straight to the receiver, and a receive from a full buffer
+//     moves the oldest waiting sender's value into it, so values are received in the order they were sent
+//   - A channel of capacity zero is a rendezvous: every send waits for a receive
+//   - Waiting senders keep their value in their awaiter, so a full channel never grows
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    template <typename T>
+    class channel {
+    public:
+        explicit channel(size_t capacity)
+            : buffer_(capacity)
+        {}
+        channel(const channel&) = delete;
+        channel& operator=(const channel&) = delete;
+        ~channel() {
+            assert(senders_.empty() && receivers_.empty());
+        }
+
+        auto send(T value) {
+            return send_awaitable{ *this, std::move(value) };
+        }
+        auto receive() noexcept {
+            return receive_awaitable{ *this };
+        }
+        // Resumes every waiting sender, whose send fails, and every waiting receiver, which receives nothing
+        // Values already in the buffer can still be received
+        void close() {
+            continuation* senders{};
+            continuation* receivers{};
+            {
+                std::lock_guard lock{ mutex_ };
+                closed_ = true;
+                senders = senders_.take_all();
+                receivers = receivers_.take_all();
+            }
+            resume_waiters(senders);
+            resume_waiters(receivers);
+        }
+        bool closed() const {
+            std::lock_guard lock{ mutex_ };
+            return closed_;
+        }
+        size_t capacity() const noexcept {
+            return buffer_.size();
+        }
+    private:
+        struct send_waiter : continuation {
+            T* value_{};
+            bool sent_{};
+        };
+        struct receive_waiter : continuation {
+            std::optional<T> value_;
+        };
+
+        // All three under the lock
+        bool full() const noexcept {
+            return size_ == buffer_.size();
+        }
+        void push_back(T&& value) {
+            buffer_[(head_ + size_) % buffer_.size()].emplace(std::move(value));
+            ++size_;
+        }
+        T pop_front() {
+            auto value{ std::move(*buffer_[head_]) };
+            buffer_[head_].reset();
+            head_ = (head_ + 1) % buffer_.size();
+            --size_;
+            return value;
+        }
+
+        class send_awaiter {
+        public:
+            send_awaiter(channel& ch, T&& value)
+                : channel_{ &ch }
+                , value_{ std::move(value) }
+            {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            // Returns false if the value could be handed over, or dropped, right away
+            template <typename promise_t>
+            bool await_suspend(std::coroutine_handle<promise_t> handle) {
+                prepare_waiter(waiter_, handle);
+                continuation* woken{};
+                {
+                    std::lock_guard lock{ channel_->mutex_ };
+                    if (channel_->closed_) {
+                        return false;
+                    }
+                    if (auto receiver{ static_cast<receive_waiter*>(channel_->receivers_.pop_front()) }) {
+                        receiver->value_.emplace(std::move(value_));
+                        woken = receiver;
+                    } else if (not channel_->full()) {
+                        channel_->push_back(std::move(value_));
+                    } else {
+                        waiter_.value_ = &value_;
+                        channel_->senders_.push_back(waiter_);
+                        return true;
+                    }
+                    waiter_.sent_ = true;
+                }
+                if (woken) {
+                    resume_waiter(*woken);
+                }
+                return false;
+            }
+            bool await_resume() const noexcept {
+                return waiter_.sent_;
+            }
+        private:
+            channel* channel_;
+            T value_;
+            send_waiter waiter_{};
+        };
+
+        class receive_awaiter {
+        public:
+            explicit receive_awaiter(channel& ch) noexcept
+                : channel_{ &ch }
+            {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            // Returns false if a value could be taken, or the channel was closed and drained, right away
+            template <typename promise_t>
+            bool await_suspend(std::coroutine_handle<promise_t> handle) {
+                prepare_waiter(waiter_, handle);
+                send_waiter* woken{};
+                {
+                    std::lock_guard lock{ channel_->mutex_ };
+                    auto sender{ static_cast<send_waiter*>(channel_->senders_.pop_front()) };
+                    if (channel_->size_ > 0) {
+                        waiter_.value_.emplace(channel_->pop_front());
+                        if (sender) {
+                            channel_->push_back(std::move(*sender->value_));
+                        }
+                    } else if (sender) {
+                        waiter_.value_.emplace(std::move(*sender->value_));
+                    } else if (not channel_->closed_) {
+                        channel_->receivers_.push_back(waiter_);
+                        return true;
+                    }
+                    if (sender) {
+                        sender->sent_ = true;
+                        woken = sender;
+                    }
+                }
+                if (woken) {
+                    resume_waiter(*woken);
+                }
+                return false;
+            }
+            std::optional<T> await_resume() {
+                return std::move(waiter_.value_);
+            }
+        private:
+            channel* channel_;
+            receive_waiter waiter_{};
+        };
+
+        class send_awaitable {
+        public:
+            send_awaitable(channel& ch, T&& value)
+                : channel_{ &ch }
+                , value_{ std::move(value) }
+            {}
+            auto operator co_await() && {
+                return send_awaiter{ *channel_, std::move(value_) };
+            }
+        private:
+            channel* channel_;
+            T value_;
+        };
+
+        class receive_awaitable {
+        public:
+            explicit receive_awaitable(channel& ch) noexcept
+                : channel_{ &ch }
+            {}
+            auto operator co_await() const noexcept {
+                return receive_awaiter{ *channel_ };
+            }
+        private:
+            channel* channel_;
+        };
+
+        mutable std::mutex mutex_;
+        std::vector<std::optional<T>> buffer_;
+        size_t head_{};
+        size_t size_{};
+        bool closed_{};
+        waiter_queue senders_;
+        waiter_queue receivers_;
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
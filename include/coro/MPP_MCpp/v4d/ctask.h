@@ -0,0 +1,702 @@
+#pragma once
+
+#include "cancellation.h"
+#include "executor.h"
+#include "frame_pool.h"
+#include "metrics.h"
+#include "task.h"
+#include "task_slab.h"
+#include "work_stealing_executor.h"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>  // byte, size_t
+#include <cstdint>  // uintptr_t
+#include <exception>  // current_exception, exception_ptr, rethrow_exception
+#include <fmt/core.h>
+#include <fmt/std.h>
+#include <functional>  // reference_wrapper
+#include <memory>  // allocate_shared, shared_ptr
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <type_traits>  // conditional_t, is_reference_v
+#include <utility>  // declval, exchange, forward, move
+
+
+// Coroutine based tasks
+//
+// See example_4d.h for a walkthrough of how a ctask is created, scheduled, co_awaited, and finished
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    // Default executor provider for tasks
+    // work_stealing_executor_provider<> can be used instead to have one queue per thread
+    using ctask_executor_provider = executor_provider<>;
+
+
+    // Executor argument
+    // A task whose first parameters are executor_arg and an executor runs on that executor, instead of its provider's,
+    // and so do the continuations of the tasks it co_awaits:
+    //   ctask<int> mul(executor_arg_t, executor_interface& executor, int a, int b);
+    //   auto t{ mul(executor_arg, nodes.local_executor(), 2, 3) };
+    struct executor_arg_t {
+        explicit executor_arg_t() = default;
+    };
+
+    inline constexpr executor_arg_t executor_arg{};
+
+
+    // Continuation
+    // Pair of coroutine_handle and executor, and the priority the coroutine is resumed with
+    // Continuations are intrusive list nodes owned by the awaiter, so registering one does not allocate
+    // Instead of a coroutine handle, a continuation can have an on_ready hook, e.g. to count down completions;
+    // the hook returns the coroutine to resume, if any
+    struct continuation {
+        using handle_type = std::coroutine_handle<>;
+        using on_ready_type = handle_type (*)(continuation&) noexcept;
+
+        handle_type handle_;
+        executor_interface* executor_{};
+        continuation* next_{};
+        on_ready_type on_ready_{};
+        priority priority_{ priority::normal };
+    };
+
+
+    // Continuation policy
+    // What a task does with its continuations when it finishes
+    //   - reschedule: schedule every continuation on its executor
+    //   - resume_inline: resume one continuation on the finishing thread via symmetric transfer, and schedule the rest
+    enum class continuation_policy { reschedule, resume_inline };
+
+
+    // Continuation manager
+    // Register continuations
+    // Resumes a collection of coroutine handles at once, possibly on a different executor each
+    //
+    // Lock-free: a single atomic state word is either
+    //   - empty: not completed, and no continuations registered,
+    //   - value or exception: completed, or
+    //   - continuation-registered: a pointer to the most recently registered continuation, which links to the older ones
+    // Registering a continuation is a CAS on the state word, and it fails if the state is already completed,
+    // so a continuation is resumed exactly once, either by the awaiter or by resume_all_continuations
+    // Nearly every task has a single awaiter: its continuation is resumed without any batching,
+    // through the completing thread's next slot (see next_slot)
+    class continuation_manager {
+    public:
+        enum class completion : std::uintptr_t { empty = 0, value = 1, exception = 2 };
+
+        // Returns false if already completed, in which case the caller should just go on instead of suspending
+        bool register_continuation(continuation& c) noexcept {
+            auto state{ state_.load(std::memory_order_acquire) };
+            do {
+                if (is_completed(state)) {
+                    return false;
+                }
+                c.next_ = reinterpret_cast<continuation*>(state);
+            } while (not state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(&c),
+                std::memory_order_release, std::memory_order_acquire));
+            return true;
+        }
+        // Returns the continuation the caller should transfer control to, or a noop coroutine
+        std::coroutine_handle<> resume_all_continuations(completion completion, continuation_policy policy) noexcept {
+            auto state{ state_.exchange(static_cast<std::uintptr_t>(completion), std::memory_order_acq_rel) };
+            state_.notify_all();
+            assert(not is_completed(state));
+            std::coroutine_handle<> next_handle{ std::noop_coroutine() };
+            bool transfer{ policy == continuation_policy::resume_inline };
+            auto first{ reinterpret_cast<continuation*>(state) };
+            if (first == nullptr) {
+                return next_handle;
+            }
+            // A single continuation, the common case, skips the batch, and goes to the thread's next slot
+            if (first->next_ == nullptr) {
+                auto executor{ first->executor_ };
+                auto priority{ first->priority_ };
+                if (auto handle{ first->on_ready_ ? first->on_ready_(*first) : first->handle_ }) {
+                    if (transfer) {
+                        return handle;
+                    }
+                    executor->schedule_next(work_item{ handle, priority, work_kind::resume });
+                }
+                return next_handle;
+            }
+            // Continuations are scheduled in bulk, one batch per run of continuations on the same executor
+            std::array<work_item, max_batch_size> batch{};
+            size_t batch_size{ 0 };
+            executor_interface* batch_executor{};
+            auto flush = [&batch, &batch_size, &batch_executor]() {
+                if (batch_size != 0) {
+                    batch_executor->schedule_bulk(std::span{ batch.data(), batch_size });
+                    batch_size = 0;
+                }
+            };
+            // Read the node before resuming, as the continuation owns its node
+            for (auto c{ first }; c != nullptr; ) {
+                auto next{ c->next_ };
+                auto executor{ c->executor_ };
+                auto priority{ c->priority_ };
+                if (auto handle{ c->on_ready_ ? c->on_ready_(*c) : c->handle_ }) {
+                    if (transfer) {
+                        next_handle = handle;
+                        transfer = false;
+                    } else {
+                        if (executor != batch_executor || batch_size == max_batch_size) {
+                            flush();
+                            batch_executor = executor;
+                        }
+                        // The coroutine handle is scheduled as is, so resuming a continuation does not allocate
+                        batch[batch_size++] = work_item{ handle, priority, work_kind::resume };
+                    }
+                }
+                c = next;
+            }
+            flush();
+            return next_handle;
+        }
+        completion get_completion() const noexcept {
+            auto state{ state_.load(std::memory_order_acquire) };
+            return is_completed(state) ? static_cast<completion>(state) : completion::empty;
+        }
+        bool ready() const noexcept {
+            return is_completed(state_.load(std::memory_order_acquire));
+        }
+        void wait() const noexcept {
+            for (auto state{ state_.load(std::memory_order_acquire) }; not is_completed(state);
+                state = state_.load(std::memory_order_acquire)) {
+                state_.wait(state, std::memory_order_acquire);
+            }
+        }
+    private:
+        static_assert(alignof(continuation) > static_cast<std::uintptr_t>(completion::exception));
+
+        static constexpr size_t max_batch_size = 16;
+
+        static bool is_completed(std::uintptr_t state) noexcept {
+            return state == static_cast<std::uintptr_t>(completion::value) ||
+                state == static_cast<std::uintptr_t>(completion::exception);
+        }
+        std::atomic<std::uintptr_t> state_{};
+    };
+
+
+    // Cache line padding
+    // Keeps the fields before it and the fields after it on different cache lines, wherever the object starts,
+    // so, unlike alignas, it doesn't need over-aligned allocations
+    struct cache_line_padding {
+        std::byte bytes_[cache_line_size];
+    };
+
+
+    // Result slot
+    // Holds the value or the exception a task completes with
+    // The result is written before the continuation manager publishes the completion, and only read after it
+    // The continuation manager's state word is what awaiters poll and CAS, and the completer exchanges, so it is kept
+    // a cache line away from the result, which only the completer writes
+    class result_slot_base {
+    public:
+        bool ready() const noexcept {
+            return continuation_manager_.ready();
+        }
+        void wait() const noexcept {
+            continuation_manager_.wait();
+        }
+        void set_exception(std::exception_ptr exception_ptr) {
+            exception_ = std::move(exception_ptr);
+            completion_ = completion::exception;
+        }
+        bool register_continuation(continuation& c) noexcept {
+            return continuation_manager_.register_continuation(c);
+        }
+        std::coroutine_handle<> resume_all_continuations(continuation_policy policy) noexcept {
+            return continuation_manager_.resume_all_continuations(completion_, policy);
+        }
+    protected:
+        using completion = continuation_manager::completion;
+
+        void wait_and_rethrow_if_exception() const {
+            wait();
+            if (continuation_manager_.get_completion() == completion::exception) {
+                std::rethrow_exception(exception_);
+            }
+        }
+
+    private:
+        continuation_manager continuation_manager_;
+        cache_line_padding padding_;
+    protected:
+        completion completion_{ completion::empty };
+    private:
+        std::exception_ptr exception_;
+    };
+
+    template <typename T>
+    class result_slot : public result_slot_base {
+    public:
+        decltype(auto) get() const {
+            wait_and_rethrow_if_exception();
+            if constexpr (std::is_reference_v<T>) {
+                return static_cast<T>(value_->get());
+            } else {
+                return (*value_);
+            }
+        }
+        void set_value(T&& value) {
+            if constexpr (std::is_reference_v<T>) {
+                value_.emplace(value);
+            } else {
+                value_.emplace(std::forward<T>(value));
+            }
+            completion_ = completion::value;
+        }
+    private:
+        using value_type = std::conditional_t<std::is_reference_v<T>,
+            std::reference_wrapper<std::remove_reference_t<T>>,
+            T>;
+
+        std::optional<value_type> value_;
+    };
+
+    template <>
+    class result_slot<void> : public result_slot_base {
+    public:
+        void get() const {
+            wait_and_rethrow_if_exception();
+        }
+        void set_value() {
+            completion_ = completion::value;
+        }
+    };
+
+
+    // Promise result
+    // Tasks returning a value need a return_value in their promise, and tasks returning void a return_void
+    template <typename promise_t, typename result_t>
+    class ctask_promise_result {
+    public:
+        auto return_value(result_t&& value) {
+            static_cast<promise_t&>(*this).set_result(std::forward<result_t>(value));
+        }
+    };
+
+    template <typename promise_t>
+    class ctask_promise_result<promise_t, void> {
+    public:
+        auto return_void() {
+            static_cast<promise_t&>(*this).set_result();
+        }
+    };
+
+
+    // Concepts
+    //
+    template <typename T>
+    concept is_executor_provider =
+        std::is_lvalue_reference_v<decltype(T::get_executor())> &&
+        std::derived_from<std::remove_reference_t<decltype(T::get_executor())>, executor_interface>;
+
+    // Task result
+    template <typename T>
+    concept is_task_result =
+        std::is_copy_constructible_v<T> ||
+        std::is_move_constructible_v<T> ||
+        std::is_void_v<T> ||
+        std::is_reference_v<T>;
+
+    template <typename T>
+    concept is_task = requires (T t) {
+        typename T::task_type;
+        typename T::promise_type;
+        typename T::handle_type;
+    };
+
+
+    template <is_task task_t>
+    class ctask_awaiter;
+
+
+    // Task
+    // A coroutine based task
+    // The executor provider decides on which executor the task and its continuations are scheduled
+    //
+    template <is_task_result result_t, is_executor_provider executor_provider_t = ctask_executor_provider>
+    class ctask {
+        class coroutine_promise;
+        class state;
+    public:
+        auto get_result() const {
+            return shared_state_->get_result().get();
+        }
+        auto wait() const {
+            shared_state_->get_result().wait();
+        }
+        bool ready() const {
+            return shared_state_->get_result().ready();
+        }
+        // Cancels the task and every task created in its body, see cancellation.h
+        void request_stop() const noexcept {
+            shared_state_->request_stop();
+        }
+        bool stop_requested() const noexcept {
+            return shared_state_->stop_requested();
+        }
+        // Whether the task's state is the last object made in slab, i.e. the task was the last one created for it
+        bool has_newest_state_in(const task_slab& slab) const noexcept {
+            return slab.is_newest(shared_state_.get());
+        }
+        // How long the task was queued, and then active; all zero unless the metrics mode is task, see metrics.h
+        metrics::task_timings get_timings() const noexcept {
+            return shared_state_->get_timings();
+        }
+        // Returns false if the task has already completed, and the continuation won't be resumed
+        // A continuation without an executor of its own is resumed on the task's executor
+        bool register_continuation(continuation& c) {
+            if (not c.executor_) {
+                c.executor_ = &shared_state_->get_executor();
+            }
+            return shared_state_->get_result().register_continuation(c);
+        }
+        // Lets coroutines other than ctasks, e.g. lazy tasks, co_await a ctask
+        // They are never interrupted, but tasks they create once resumed are still linked to the current ctask
+        auto operator co_await() const {
+            return ctask_awaiter<task_type>{ *this, priority::normal, nullptr, cancellation_node::current(), false };
+        }
+
+        using promise_type = coroutine_promise;
+        using result_type = result_t;
+        using task_type = ctask<result_t, executor_provider_t>;
+        using executor_provider_type = executor_provider_t;
+        using handle_type = std::coroutine_handle<task_type::promise_type>;
+    private:
+        ctask(handle_type handle)
+            : shared_state_{ std::allocate_shared<state>(frame_allocator<state>{}, handle, false) }
+        {}
+        // A task spawned in a task scope has its state in the scope's slab
+        // The shared pointer doesn't own it, so copying it touches no reference count
+        ctask(handle_type handle, task_slab& slab)
+            : shared_state_{ std::shared_ptr<void>{}, &slab.make<state>(handle, true) }
+        {}
+
+        std::shared_ptr<state> shared_state_;
+    };
+
+
+    // Task scheduler
+    // The awaiter schedules tasks on an executor thread
+    // The coroutine handle itself is what gets queued, so starting a task neither allocates nor touches the shared state
+    // A task cancelled while queued is skipped: it completes with task_cancelled without running its body
+    template <is_task task_t>
+    class ctask_scheduler : public std::suspend_always {
+    public:
+        void await_suspend(task_t::handle_type handle) noexcept {
+            debug_print("ctask_scheduler", "await_suspend", indentation{ 2 });
+            handle_ = handle;
+            handle.promise().get_executor().schedule(std::coroutine_handle<>{ handle });
+        }
+        // Runs on the executor thread, once the task has been dequeued
+        // Throwing here ends up in unhandled_exception, as if the body had thrown
+        void await_resume() const {
+            debug_print("", "execute", indentation{ 4 });
+            handle_.promise().record_start();
+            auto node{ handle_.promise().get_cancellation_node() };
+            cancellation_node::current() = node;
+            if (node->stop_requested()) {
+                throw task_cancelled{};
+            }
+        }
+    private:
+        task_t::handle_type handle_;
+    };
+
+
+    // Final awaiter
+    // Resumes the continuations once the coroutine is suspended at its final suspend point
+    // The coroutine frame is destroyed here, as it would be with suspend_never,
+    // and then control is transferred to the continuation returned by the continuation manager
+    template <typename promise_t>
+    class ctask_final_awaiter : public std::suspend_always {
+    public:
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) const noexcept {
+            // Keep the state alive until the continuations have been resumed
+            auto state{ handle.promise().release_state() };
+            debug_print(state->get_name(), "final_suspend: resume all continuations", indentation{1});
+            auto next_handle{ state->resume_all_continuations() };
+            handle.destroy();
+            return next_handle;
+        }
+    };
+
+
+    template <is_task task_t>
+    class ctask_awaiter {
+    public:
+        // The continuation is resumed on executor, if any, or on the task's executor
+        // Once resumed, node is the current cancellation node again, and an interruptible awaiter throws task_cancelled
+        // if its stop has been requested in the meantime
+        ctask_awaiter(task_t t, priority p = priority::normal, executor_interface* executor = nullptr,
+            cancellation_node* node = nullptr, bool interruptible = false)
+            : task_{ std::move(t) }
+            , node_{ node }
+            , interruptible_{ interruptible } {
+            continuation_.priority_ = p;
+            continuation_.executor_ = executor;
+        }
+
+        // Compiler-generated code will invoke await_ready before invoking await_suspend
+        bool await_ready() const noexcept {
+            debug_print("ctask_awaiter", "await_ready", indentation{ 2 });
+            return task_.ready();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            debug_print("ctask_awaiter", "await_suspend", indentation{ 2 });
+            debug_print("ctask_awaiter", "await_suspend: register continuation", indentation{ 2 });
+            continuation_.handle_ = handle;
+            // Registration fails if the task completed in the meantime, and then we don't suspend
+            return task_.register_continuation(continuation_);
+        }
+        // Compiler-generated code will invoke await_resume after the coroutine has been resumed but before any code has been executed
+        // The return value of this function is the return value of the co_await operator, and it can be any type we want
+        // If we return the result of the task, the user will be able to call co_await and use the result without having to call get
+        // E.g.
+        // task<int> task = calculate();
+        // int x = co_await task;
+        auto await_resume() const {
+            debug_print("ctask_awaiter", "await_resume", indentation{ 2 });
+            if (node_) {
+                cancellation_node::current() = node_;
+                if (interruptible_ && node_->stop_requested()) {
+                    throw task_cancelled{};
+                }
+            }
+            return task_.get_result();
+        }
+    private:
+        task_t task_;
+        continuation continuation_{};
+        cancellation_node* node_;
+        bool interruptible_;
+    };
+
+
+    // Awaiter of any other awaitable, e.g. a lazy task or when_all
+    // Makes the ctask's cancellation node current again once the ctask is resumed, but never interrupts it
+    // The inner awaiter is constructed in place, since some, e.g. when_all's, can't be moved
+    template <typename awaitable_t>
+    class ctask_resume_awaiter {
+        using awaiter_t = decltype(std::declval<awaitable_t>().operator co_await());
+    public:
+        ctask_resume_awaiter(awaitable_t&& awaitable, cancellation_node* node)
+            : awaiter_{ std::forward<awaitable_t>(awaitable).operator co_await() }
+            , node_{ node }
+        {}
+        bool await_ready() {
+            return awaiter_.await_ready();
+        }
+        template <typename promise_t>
+        decltype(auto) await_suspend(std::coroutine_handle<promise_t> handle) {
+            return awaiter_.await_suspend(handle);
+        }
+        decltype(auto) await_resume() {
+            cancellation_node::current() = node_;
+            return awaiter_.await_resume();
+        }
+    private:
+        awaiter_t awaiter_;
+        cancellation_node* node_;
+    };
+
+
+    // Shared state
+    // Shared between all instances of a task
+    // It is the task's cancellation node too, linked to the node of the ctask whose body created it, if any
+    // A task spawned in a task scope can't outlive its parent, and tasks created by a scoped task are bounded by it,
+    // see task_scope.h, so those links don't own the parent
+    //
+    // Fields are grouped by who touches them, and the groups are kept a cache line apart:
+    //   - read-mostly: the cancellation node, the executor, and the continuation policy, all set before the body runs
+    //   - the continuation manager's state word, polled and CASed by awaiters, and exchanged by the completer
+    //   - the result, only written by the completer, before it publishes the completion, and the task clock,
+    //     which takes no space unless the metrics mode is task
+    //   - cold: the debug name, which is empty unless tracing is on
+    // Every task counts as in flight on its executor's metrics from its creation until its completion
+    template <is_task_result result_t, is_executor_provider executor_provider_t>
+    class ctask<result_t, executor_provider_t>::state : public cancellation_node {
+    public:
+        state(handle_type handle, bool scoped)
+            : executor_{ &handle.promise().get_executor() } {
+            if (auto parent{ cancellation_node::current() }) {
+                auto owner{ scoped ? std::shared_ptr<cancellation_node>{} : parent->weak_from_this().lock() };
+                set_parent(owner ? std::move(owner) : std::shared_ptr<cancellation_node>{ owner, parent });
+            }
+            if constexpr (metrics::enabled) {
+                if (auto m{ executor_->get_metrics() }) {
+                    m->task_created();
+                }
+            }
+        }
+        ~state() {
+            debug_print(name_.get(), "~state", indentation{ 4 });
+        }
+        std::string_view get_name() const noexcept {
+            return name_.get();
+        }
+        auto set_name(std::string name) {
+            name_.set(std::move(name));
+        }
+        auto& get_result() {
+            return result_;
+        }
+        executor_interface& get_executor() const noexcept {
+            return *executor_;
+        }
+        template <typename... Args>
+        void set_result(Args&&... args) {
+            result_.set_value(std::forward<Args>(args)...);
+        }
+        void set_exception(std::exception_ptr exception_ptr) {
+            result_.set_exception(std::move(exception_ptr));
+        }
+        void set_continuation_policy(continuation_policy policy) {
+            continuation_policy_ = policy;
+        }
+        std::coroutine_handle<> resume_all_continuations() {
+            clock_.completed();
+            if constexpr (metrics::enabled) {
+                if (auto m{ executor_->get_metrics() }) {
+                    m->task_completed();
+                }
+            }
+            return result_.resume_all_continuations(continuation_policy_);
+        }
+        void record_start() noexcept {
+            clock_.started();
+        }
+        metrics::task_timings get_timings() const noexcept {
+            return clock_.get();
+        }
+
+    private:
+        executor_interface* executor_;
+        continuation_policy continuation_policy_{ continuation_policy::reschedule };
+        cache_line_padding padding_;
+        result_slot<result_t> result_;
+        [[no_unique_address]] metrics::task_clock<> clock_;
+        [[no_unique_address]] debug_name<> name_;
+    };
+
+
+    // Promise type
+    //
+    template <is_task_result result_t, is_executor_provider executor_provider_t>
+    class ctask<result_t, executor_provider_t>::coroutine_promise
+        : public ctask_promise_result<typename ctask<result_t, executor_provider_t>::coroutine_promise, result_t> {
+    public:
+        // Coroutine frames are recycled through the frame pool
+        static void* operator new(std::size_t size) {
+            return frame_pool::allocate(size);
+        }
+        static void operator delete(void* ptr, std::size_t size) noexcept {
+            frame_pool::deallocate(ptr, size);
+        }
+        // Runs on the provider's executor, unless the task's first parameters are executor_arg and an executor,
+        // or, for member functions, the first ones after the object
+        coroutine_promise()
+            : executor_{ &executor_provider_t::get_executor() }
+        {}
+        template <typename... Args>
+        coroutine_promise(executor_arg_t, executor_interface& executor, Args&&...) noexcept
+            : executor_{ &executor }
+        {}
+        template <typename self_t, typename... Args>
+        coroutine_promise(self_t&&, executor_arg_t, executor_interface& executor, Args&&...) noexcept
+            : executor_{ &executor }
+        {}
+        executor_interface& get_executor() const noexcept {
+            return *executor_;
+        }
+        auto get_return_object() {
+            debug_print("", "get_return_object", indentation{ 1 });
+            auto handle{ handle_type::from_promise(*this) };
+            auto slab{ std::exchange(task_slab::current(), nullptr) };
+            auto ret{ slab ? task_type{ handle, *slab } : task_type{ handle } };
+            state_ = ret.shared_state_;
+            return ret;
+        }
+        auto initial_suspend() {
+            debug_print("", "initial_suspend", indentation{ 1 });
+            return ctask_scheduler<task_type>{};
+        }
+        auto final_suspend() noexcept {
+            debug_print(state_->get_name(), "final_suspend", indentation{1});
+            return ctask_final_awaiter<coroutine_promise>{};
+        }
+        // Called from return_value, or return_void
+        template <typename... Args>
+        void set_result(Args&&... args) {
+            debug_print(state_->get_name(), "return_value", indentation{1});
+            state_->set_result(std::forward<Args>(args)...);
+        }
+        auto unhandled_exception() {
+            debug_print(state_->get_name(), "unhandled_exception", indentation{1});
+            state_->set_exception(std::current_exception());
+        }
+        auto await_transform(std::string name) {
+            state_->set_name(std::move(name));
+            return std::suspend_never{};
+        }
+        auto await_transform(continuation_policy policy) {
+            state_->set_continuation_policy(policy);
+            return std::suspend_never{};
+        }
+        // The priority this task is resumed with whenever it co_awaits another task, e.g. co_await priority::high
+        auto await_transform(priority p) noexcept {
+            priority_ = p;
+            return std::suspend_never{};
+        }
+        // An external stop token the task, and the tasks it creates, observe too, e.g. co_await executor_stop_token
+        auto await_transform(std::stop_token token) noexcept {
+            state_->set_stop_token(std::move(token));
+            return std::suspend_never{};
+        }
+        // Check point: co_await cancelled() returns whether the task's stop has been requested
+        auto await_transform(cancelled_t) noexcept {
+            return cancelled_awaiter{ *state_ };
+        }
+        template <is_task other_task_t>
+        auto await_transform(other_task_t other_task) {
+            debug_print(state_->get_name(), "await_transform(other_task)", indentation{1});
+            return ctask_awaiter<other_task_t>{ std::move(other_task), priority_, executor_, state_.get(), true };
+        }
+        // Any other awaitable with its own operator co_await, e.g. a lazy task
+        template <typename awaitable_t>
+            requires (not is_task<std::remove_cvref_t<awaitable_t>>) && requires (awaitable_t&& a) {
+                std::forward<awaitable_t>(a).operator co_await();
+            }
+        auto await_transform(awaitable_t&& awaitable) {
+            return ctask_resume_awaiter<awaitable_t>{ std::forward<awaitable_t>(awaitable), state_.get() };
+        }
+        // Hands the state over to the final awaiter, without touching the reference count
+        auto release_state() noexcept {
+            return std::move(state_);
+        }
+        cancellation_node* get_cancellation_node() const noexcept {
+            return state_.get();
+        }
+        void record_start() noexcept {
+            state_->record_start();
+        }
+    private:
+        // The promise keeps the state alive until the final awaiter takes it, so the state is reachable
+        // without locking a weak pointer, i.e. without an atomic read-modify-write, and the raw current
+        // cancellation node can't dangle
+        std::shared_ptr<state> state_;
+        executor_interface* executor_;
+        priority priority_{ priority::normal };
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,696 @@
+#pragma once
+
+#include "affinity.h"
+#include "cancellation.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <algorithm>  // all_of, for_each, max, min
+#include <array>
+#include <atomic>
+#include <condition_variable>  // condition_variable_any
+#include <coroutine>
+#include <cstdint>  // int64_t, uint64_t
+#include <fmt/core.h>
+#include <functional>  // bind_front
+#include <memory>  // enable_shared_from_this, shared_ptr
+#include <mutex>  // lock_guard, unique_lock
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>  // jthread
+#include <utility>  // exchange, move
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>  // _mm_pause
+#endif
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    // Fixed instead of std::hardware_destructive_interference_size, whose value may change between compiler flags
+    constexpr size_t cache_line_size = 64;
+
+
+    // Debug print helper
+    // Compiles to nothing, prints, or records into a ring buffer, depending on the trace mode (see trace.h)
+    struct indentation {
+        std::string::size_type level;
+    };
+
+    inline void debug_print(std::string_view name, std::string_view text, const indentation& indentation = {}) {
+        if constexpr (trace::mode == trace::mode_type::print) {
+            std::lock_guard lock{ trace::print_mutex() };
+            fmt::print("{:{}}{} [{}]\n",
+                "", indentation.level * 8,
+                (name.empty() ? "undefined" : name),
+                text
+            );
+        } else if constexpr (trace::mode == trace::mode_type::ring_buffer) {
+            trace::record(name, text, indentation.level);
+        }
+    }
+
+    // Debug name
+    // Only kept if tracing is on; otherwise it takes no space, and naming a task does nothing
+    template <bool enabled = trace::enabled>
+    class debug_name {
+    public:
+        std::string_view get() const noexcept {
+            return name_;
+        }
+        void set(std::string name) {
+            name_ = std::move(name);
+        }
+    private:
+        std::string name_;
+    };
+
+    template <>
+    class debug_name<false> {
+    public:
+        std::string_view get() const noexcept {
+            return {};
+        }
+        void set(std::string) noexcept {}
+    };
+
+
+    // Executable
+    // Interface class for tasks running in a thread
+    //
+    class executable : public std::enable_shared_from_this<executable> {
+    public:
+        virtual void execute() noexcept = 0;
+        virtual ~executable() = default;
+    };
+
+    using executable_ptr = std::shared_ptr<executable>;
+
+
+    // Priority
+    // Executors keep one lane per priority, and always run high priority work before normal priority work,
+    // and normal priority work before low priority work
+    // Strict priority: low priority work only runs when there is nothing else to do
+    //
+    enum class priority : unsigned char { high, normal, low };
+
+    constexpr size_t number_of_priorities = 3;
+
+    constexpr size_t to_lane(priority p) noexcept {
+        return static_cast<size_t>(p);
+    }
+
+
+    // Work kind
+    // Only tells metrics apart: a run starts some work, e.g. a task's body, and a resume continues a coroutine that
+    // was waiting for a result, e.g. a continuation
+    enum class work_kind : unsigned char { run, resume };
+
+
+    // Work item
+    // What executors queue: either an executable, or a bare coroutine handle, and its priority
+    // Scheduling a coroutine handle is intrusive: the coroutine frame is the node, so nothing is allocated and no
+    // reference count is touched
+    // Once it has run, no ctask is running on the thread anymore, so the current cancellation node is reset
+    // If metrics are on, it carries the time it was scheduled at
+    //
+    class work_item {
+    public:
+        work_item() = default;
+        work_item(executable_ptr ex, priority p = priority::normal)
+            : executable_{ std::move(ex) }
+            , priority_{ p }
+        {}
+        work_item(std::coroutine_handle<> handle, priority p = priority::normal, work_kind kind = work_kind::run)
+            : handle_{ handle }
+            , priority_{ p }
+            , kind_{ kind }
+        {}
+        void execute() noexcept {
+            if (handle_) {
+                handle_.resume();
+            } else {
+                executable_->execute();
+            }
+            cancellation_node::current() = nullptr;
+        }
+        priority get_priority() const noexcept {
+            return priority_;
+        }
+        work_kind get_kind() const noexcept {
+            return kind_;
+        }
+        std::uint64_t get_scheduled_at() const noexcept {
+            return scheduled_at_.get();
+        }
+        void set_scheduled_at(std::uint64_t timestamp) noexcept {
+            scheduled_at_.set(timestamp);
+        }
+    private:
+        std::coroutine_handle<> handle_;
+        executable_ptr executable_;
+        priority priority_{ priority::normal };
+        work_kind kind_{ work_kind::run };
+        [[no_unique_address]] metrics::stamp<> scheduled_at_;
+    };
+
+
+    // Executor metrics snapshot
+    // Totals since the executor started, except for the gauges, tasks in flight and queue depth
+    // Latencies are in nanoseconds, and sampled, so their counts are about one in sample_period of the items:
+    //   - schedule_to_run: from schedule until the item starts running, for items that start work
+    //   - resume_latency: from schedule until the item starts running, for resumes, i.e. from a task's completion
+    //     until its continuation runs
+    //   - run_duration: how long items ran, until they returned or suspended
+    //
+    struct executor_metrics_snapshot {
+        metrics::clock::time_point taken_at{ metrics::clock::now() };
+        std::uint64_t scheduled{};
+        std::uint64_t executed{};
+        std::uint64_t resumes{};
+        std::uint64_t steals{};
+        std::int64_t tasks_in_flight{};
+        size_t queue_depth{};
+        metrics::histogram_snapshot schedule_to_run{};
+        metrics::histogram_snapshot resume_latency{};
+        metrics::histogram_snapshot run_duration{};
+    };
+
+    using metrics::per_second;
+
+
+    // Executor metrics
+    // One shard of counters and histograms per thread that records into them, be it an executor thread or any other,
+    // e.g. the main thread creating tasks, or an io thread running an asio_executor's items,
+    // so recording never contends, and taking a snapshot adds them all up
+    //
+    // Notes on implementation:
+    //
+    //   - A thread registers its shard the first time it records, under a lock, and finds it again through a small
+    //     thread local cache, indexed by the metrics' id; executor threads register when they start
+    //   - Ids are never reused, so a cache entry left by metrics since destroyed never matches again
+    //   - Registration looks the thread up first, so a thread whose entry was evicted, e.g. by the metrics of another
+    //     executor it schedules on, gets its shard back rather than a new one
+    //   - Counters are exact, but timing every item would take three clock reads each, which would cost more than
+    //     scheduling them, so one item in sample_period is timed: every thread stamps one in sample_period of the items
+    //     it schedules, and only stamped items are timed when they run
+    //   - Continuations resumed inline, through symmetric transfer, never go through an executor,
+    //     so they are neither counted nor timed
+    //   - Nothing is allocated, and every call does nothing, if metrics are off
+    //
+    class executor_metrics {
+    public:
+        executor_metrics() = default;
+        executor_metrics(const executor_metrics&) = delete;
+        executor_metrics& operator=(const executor_metrics&) = delete;
+
+        // Called by every executor thread before it runs anything, so that it never takes the lock afterwards
+        void attach_thread() noexcept {
+            if constexpr (metrics::enabled) {
+                local();
+            }
+        }
+
+        static constexpr size_t sample_period = 16;  // a power of two
+
+        void scheduled(work_item& item) noexcept {
+            if constexpr (metrics::enabled) {
+                if (sample()) {
+                    item.set_scheduled_at(metrics::now());
+                }
+                local().scheduled_.add();
+            }
+        }
+        void scheduled(std::span<work_item> items) noexcept {
+            if constexpr (metrics::enabled) {
+                std::uint64_t now{};
+                for (auto& item : items) {
+                    if (sample()) {
+                        now = (now != 0) ? now : metrics::now();
+                        item.set_scheduled_at(now);
+                    }
+                }
+                local().scheduled_.add(items.size());
+            }
+        }
+        // Executes the item, and times it if it was sampled
+        void execute(work_item& item) noexcept {
+            if constexpr (metrics::enabled) {
+                auto& s{ local() };
+                auto resume{ item.get_kind() == work_kind::resume };
+                s.executed_.add();
+                if (resume) {
+                    s.resumes_.add();
+                }
+                auto scheduled_at{ item.get_scheduled_at() };
+                if (scheduled_at == 0) {
+                    item.execute();
+                    return;
+                }
+                auto start{ metrics::now() };
+                auto waited{ start - std::min(start, scheduled_at) };
+                (resume ? s.resume_latency_ : s.schedule_to_run_).record(waited);
+                item.execute();
+                s.run_duration_.record(metrics::now() - start);
+            } else {
+                item.execute();
+            }
+        }
+        void stolen() noexcept {
+            if constexpr (metrics::enabled) {
+                local().steals_.add();
+            }
+        }
+        void task_created() noexcept {
+            if constexpr (metrics::enabled) {
+                local().tasks_in_flight_.add(1);
+            }
+        }
+        void task_completed() noexcept {
+            if constexpr (metrics::enabled) {
+                local().tasks_in_flight_.add(-1);
+            }
+        }
+
+        executor_metrics_snapshot snapshot(size_t queue_depth) const {
+            executor_metrics_snapshot snapshot{};
+            snapshot.queue_depth = queue_depth;
+            std::lock_guard lock{ mutex_ };
+            for (const auto& [thread, s] : shards_) {
+                snapshot.scheduled += s->scheduled_.load();
+                snapshot.executed += s->executed_.load();
+                snapshot.resumes += s->resumes_.load();
+                snapshot.steals += s->steals_.load();
+                snapshot.tasks_in_flight += s->tasks_in_flight_.load();
+                s->schedule_to_run_.add_to(snapshot.schedule_to_run);
+                s->resume_latency_.add_to(snapshot.resume_latency);
+                s->run_duration_.add_to(snapshot.run_duration);
+            }
+            return snapshot;
+        }
+    private:
+        struct alignas(cache_line_size) shard {
+            metrics::counter<> scheduled_;
+            metrics::counter<> executed_;
+            metrics::counter<> resumes_;
+            metrics::counter<> steals_;
+            metrics::counter<std::int64_t> tasks_in_flight_;
+            metrics::histogram schedule_to_run_;
+            metrics::histogram resume_latency_;
+            metrics::histogram run_duration_;
+        };
+        // Zeroed, as every thread local, and 0 is no id
+        struct cache_entry {
+            std::uint64_t id_;
+            shard* shard_;
+        };
+        static constexpr size_t cache_size = 8;  // a power of two
+
+        shard& local() noexcept {
+            auto& entry{ cache_[id_ & (cache_size - 1)] };
+            if (entry.id_ != id_) {
+                entry = { id_, &register_thread() };
+            }
+            return *entry.shard_;
+        }
+        shard& register_thread() noexcept {
+            auto thread{ std::this_thread::get_id() };
+            std::lock_guard lock{ mutex_ };
+            for (auto& [t, s] : shards_) {
+                if (t == thread) {
+                    return *s;
+                }
+            }
+            return *shards_.emplace_back(thread, std::make_unique<shard>()).second;
+        }
+        static bool sample() noexcept {
+            return (++sample_count_ & (sample_period - 1)) == 0;
+        }
+
+        static inline std::atomic<std::uint64_t> next_id_{ 1 };
+        static inline thread_local std::array<cache_entry, cache_size> cache_;
+        static inline thread_local size_t sample_count_{};
+
+        const std::uint64_t id_{ next_id_.fetch_add(1, std::memory_order_relaxed) };
+        mutable std::mutex mutex_;
+        std::vector<std::pair<std::thread::id, std::unique_ptr<shard>>> shards_;
+    };
+
+
+    // Work queue
+    // Double-ended ring buffer
+    // Unlike std::deque, it only allocates when it has to grow, so a steady flow of pushes and pops never allocates
+    //
+    template <typename T>
+    class work_queue {
+    public:
+        bool empty() const noexcept {
+            return size_ == 0;
+        }
+        size_t size() const noexcept {
+            return size_;
+        }
+        void push_back(T t) {
+            if (size_ == buffer_.size()) {
+                grow();
+            }
+            buffer_[(head_ + size_) & (buffer_.size() - 1)] = std::move(t);
+            ++size_;
+        }
+        T pop_front() {
+            auto ret{ std::exchange(buffer_[head_], T{}) };
+            head_ = (head_ + 1) & (buffer_.size() - 1);
+            --size_;
+            return ret;
+        }
+        T pop_back() {
+            --size_;
+            return std::exchange(buffer_[(head_ + size_) & (buffer_.size() - 1)], T{});
+        }
+    private:
+        void grow() {
+            std::vector<T> buffer(buffer_.empty() ? 64 : buffer_.size() * 2);
+            for (size_t i{ 0 }; i < size_; ++i) {
+                buffer[i] = std::move(buffer_[(head_ + i) & (buffer_.size() - 1)]);
+            }
+            buffer_ = std::move(buffer);
+            head_ = 0;
+        }
+
+        std::vector<T> buffer_;  // size is always zero or a power of two
+        size_t head_{};
+        size_t size_{};
+    };
+
+
+    // Executor interface
+    // Interface class for anything that can schedule work
+    // Tasks and continuations only see this interface, so thread pools with different queueing strategies can be swapped
+    //
+    class executor_interface {
+    public:
+        virtual void schedule(work_item item) = 0;
+        // Schedules many items at once, e.g. all the continuations of a task
+        // Executors override it to take their locks once, and to only wake as many threads as there are items
+        virtual void schedule_bulk(std::span<work_item> items) {
+            for (auto& item : items) {
+                schedule(std::move(item));
+            }
+        }
+        // Schedules an item to run right after the one running on the calling thread, e.g. the only continuation
+        // of the task the thread is completing
+        // Executors override it to keep the item in the thread's next slot, when called from one of their threads
+        virtual void schedule_next(work_item item) {
+            schedule(std::move(item));
+        }
+        // Metrics, if the executor keeps any, see executor_metrics; tasks record into them too
+        executor_metrics* get_metrics() const noexcept {
+            return metrics_;
+        }
+        // Executors override it to add what only they know, e.g. the queue depth
+        virtual executor_metrics_snapshot get_metrics_snapshot() const {
+            return metrics_ ? metrics_->snapshot(0) : executor_metrics_snapshot{};
+        }
+        virtual ~executor_interface() = default;
+    protected:
+        executor_metrics* metrics_{};
+    };
+
+
+    // Next slot
+    // Every executor thread has room for one work item that runs as soon as the current one returns
+    // A continuation that goes there skips the queue, its lock, and the wake-up, and it runs on the thread that
+    // has just produced the result, while the result is still in cache
+    //
+    // Notes on implementation:
+    //
+    //   - Only the thread itself fills and runs its slot, so nothing is synchronized
+    //   - Streaks are capped: after max_streak items in a row from the slot, the next item goes through the queue,
+    //     so queued work can't starve, and other threads get a chance to run it
+    //   - Priorities still hold: low priority work always goes through the queue, and normal priority work does too
+    //     if, by the time it would run, high priority work has been queued
+    //   - The item was counted and stamped when it was put in the slot, so requeue must not do it again; its wait then
+    //     includes the time it spent in the slot
+    //
+    class next_slot {
+    public:
+        static constexpr size_t max_streak = 32;
+
+        // Whether the item can take the slot, or has to be queued instead
+        bool accepts(const work_item& item) const noexcept {
+            return not item_ && streak_ != max_streak && item.get_priority() != priority::low;
+        }
+        void put(work_item item) noexcept {
+            item_ = std::move(item);
+        }
+        // Called after every item the thread runs
+        // preempted tells whether higher priority work than the item's is queued, and then requeue queues the item too
+        template <typename predicate_t, typename requeue_t>
+        void run(executor_metrics& metrics, predicate_t&& preempted, requeue_t&& requeue) {
+            while (item_) {
+                auto item{ std::move(*item_) };
+                item_.reset();
+                if (preempted(item.get_priority())) {
+                    requeue(std::move(item));
+                    break;
+                }
+                ++streak_;
+                metrics.execute(item);
+            }
+            streak_ = 0;
+        }
+    private:
+        std::optional<work_item> item_;
+        size_t streak_{};
+    };
+
+
+    // Spin before parking
+    // A worker that runs out of work spins for a while before going to sleep, in case more work comes right away,
+    // which saves a futex wait on the worker's side, and a futex wake on the scheduler's side
+    // The spin budget adapts: it doubles every time spinning finds work, and halves every time it doesn't,
+    // so workers that keep on parking anyway soon stop burning cycles
+    //
+    inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    class adaptive_spin {
+    public:
+        static constexpr size_t min_spins = 16;
+        static constexpr size_t max_spins = 4096;
+
+        // Returns true as soon as has_work does, or false once the budget is spent
+        template <typename predicate_t>
+        bool spin(predicate_t&& has_work) noexcept {
+            for (size_t i{ 0 }; i < spins_; ++i) {
+                if (has_work()) {
+                    spins_ = std::min(spins_ * 2, max_spins);
+                    return true;
+                }
+                cpu_relax();
+            }
+            spins_ = std::max(spins_ / 2, min_spins);
+            return false;
+        }
+    private:
+        size_t spins_{ min_spins };
+    };
+
+
+    // Executor
+    // Thread pool
+    // Schedules tasks to be run in a thread and executes them
+    // One FIFO queue per priority lane, all of them behind the same mutex
+    // Threads are pinned to cores, if any are given
+    // Idle threads spin for a while before parking, and scheduling only notifies when some thread is parked
+    // Every thread has a next slot, for continuations scheduled from the thread itself
+    // Keeps executor metrics
+    //
+    class executor final : public executor_interface {
+    public:
+        executor(size_t number_of_threads, std::vector<size_t> cores = {})
+            : cores_{ std::move(cores) } {
+            metrics_ = &own_metrics_;
+            for (size_t i{ 0 }; i < number_of_threads; ++i) {
+                threads_.emplace_back(std::bind_front(&executor::run_thread, this));
+            }
+        }
+        ~executor() {
+            debug_print("executor", "~executor");
+            std::ranges::for_each(threads_, [](std::jthread& t) { t.request_stop(); });
+            std::ranges::for_each(threads_, [](std::jthread& t) { t.join(); });
+        }
+        void schedule(work_item item) override {
+            own_metrics_.scheduled(item);
+            enqueue(std::move(item));
+        }
+        void schedule_bulk(std::span<work_item> items) override {
+            own_metrics_.scheduled(items);
+            size_t wake{};
+            {
+                std::lock_guard lock{ mutex_ };
+                for (auto& item : items) {
+                    push_back(std::move(item));
+                }
+                wake = std::min(items.size(), sleepers_);
+            }
+            for (size_t i{ 0 }; i < wake; ++i) {
+                cva_.notify_one();
+            }
+        }
+        void schedule_next(work_item item) override {
+            if (current_executor_ == this && next_slot_.accepts(item)) {
+                own_metrics_.scheduled(item);
+                next_slot_.put(std::move(item));
+            } else {
+                schedule(std::move(item));
+            }
+        }
+        executor_metrics_snapshot get_metrics_snapshot() const override {
+            return own_metrics_.snapshot(pending_.load(std::memory_order_relaxed));
+        }
+    private:
+        void run_thread(std::stop_token stoken) {
+            pin_current_thread(cores_);
+            current_executor_ = this;
+            own_metrics_.attach_thread();
+            adaptive_spin spinner{};
+            while (true) {
+                if (pending_.load(std::memory_order_relaxed) == 0) {
+                    spinner.spin([this, &stoken]() {
+                        return pending_.load(std::memory_order_relaxed) != 0 || stoken.stop_requested();
+                    });
+                }
+                std::unique_lock<std::mutex> lock{ mutex_ };
+                if (empty()) {
+                    // schedule checks for sleepers under the lock, so a push can't slip in between here and the wait
+                    ++sleepers_;
+                    cva_.wait(lock, stoken, [this]() {
+                        return not empty();
+                    });
+                    --sleepers_;
+                    if (stoken.stop_requested()) {
+                        break;
+                    }
+                }
+                auto next{ pop_front() };
+                lock.unlock();
+                own_metrics_.execute(next);
+                next_slot_.run(own_metrics_,
+                    [this](priority p) {
+                        return p != priority::high && high_pending_.load(std::memory_order_relaxed) != 0;
+                    },
+                    [this](work_item item) { enqueue(std::move(item)); });
+            }
+            current_executor_ = nullptr;
+            debug_print("executor", "exiting run_thread");
+        }
+        // schedule without the metrics
+        void enqueue(work_item item) {
+            bool wake{};
+            {
+                std::lock_guard lock{ mutex_ };
+                push_back(std::move(item));
+                wake = sleepers_ > 0;
+            }
+            if (wake) {
+                cva_.notify_one();
+            }
+        }
+        bool empty() const noexcept {
+            return std::ranges::all_of(lanes_, [](const auto& lane) { return lane.empty(); });
+        }
+        // Both under the lock
+        void push_back(work_item item) {
+            auto p{ item.get_priority() };
+            lanes_[to_lane(p)].push_back(std::move(item));
+            pending_.store(pending_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (p == priority::high) {
+                high_pending_.store(high_pending_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+        // From the highest priority lane that has work; there is at least one
+        work_item pop_front() {
+            pending_.store(pending_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            for (auto& lane : lanes_) {
+                if (not lane.empty()) {
+                    if (&lane == &lanes_[to_lane(priority::high)]) {
+                        high_pending_.store(high_pending_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                    }
+                    return lane.pop_front();
+                }
+            }
+            return {};
+        }
+
+        static inline thread_local executor* current_executor_{};
+        static inline thread_local next_slot next_slot_{};
+
+        std::vector<size_t> cores_;
+        executor_metrics own_metrics_;
+        std::vector<std::jthread> threads_;
+        std::mutex mutex_;
+        std::array<work_queue<work_item>, number_of_priorities> lanes_;
+        std::atomic<size_t> pending_{};  // written under the lock, read without it by spinning threads
+        std::atomic<size_t> high_pending_{};  // written under the lock, read without it by the next slot
+        size_t sleepers_{};
+        std::condition_variable_any cva_;
+    };
+
+
+    // Executor provider
+    // Implemented as a singleton
+    // Sized at compile time; see configurable_executor_provider for sizing at startup,
+    // and node_executors for one executor per NUMA node
+    //
+    constexpr size_t DEFAULT_CONCURRENCY = 4;
+
+    template <size_t concurrency_level = DEFAULT_CONCURRENCY, typename executor_t = executor>
+    class executor_provider {
+    public:
+        static executor_t& get_executor() {
+            static executor_t instance{ concurrency_level };
+            return instance;
+        }
+    };
+
+
+    // Executor options
+    // No cores means the threads are not pinned
+    struct executor_options {
+        size_t number_of_threads{ number_of_cores() };
+        std::vector<size_t> cores{};
+    };
+
+
+    // Configurable executor provider
+    // Also a singleton, but sized at startup, e.g. from hardware_concurrency or from a config file:
+    //   configurable_executor_provider<>::configure({ .number_of_threads = config.threads, .cores = config.cores });
+    // configure has to be called before the first get_executor, which creates the executor; later calls have no effect
+    // tag_t tells providers apart, so that there can be more than one
+    //
+    template <typename executor_t = executor, typename tag_t = void>
+    class configurable_executor_provider {
+    public:
+        static void configure(executor_options options) {
+            get_options() = std::move(options);
+        }
+        static executor_t& get_executor() {
+            static executor_t instance{ get_options().number_of_threads, get_options().cores };
+            return instance;
+        }
+    private:
+        static executor_options& get_options() {
+            static executor_options options{};
+            return options;
+        }
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
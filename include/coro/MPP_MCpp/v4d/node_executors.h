@@ -0,0 +1,67 @@
+#pragma once
+
+#include "affinity.h"
+#include "executor.h"
+
+#include <cstddef>  // size_t
+#include <memory>  // make_unique, unique_ptr
+#include <vector>
+
+
+// Node executors
+//
+// One executor per NUMA node, with its threads pinned to the cores of the node
+// Tasks created with executor_arg run on the executor they are given, and so do their continuations,
+// so a task started on its home node's executor stays on that node:
+//
+//   node_executors<> nodes{};
+//   auto t{ mul(executor_arg, nodes.local_executor(), 2, 3) };
+//
+// Notes on implementation:
+//
+//   - Nodes come from numa_nodes() (see affinity.h); a machine whose topology is unknown is a single node
+//   - The threads of an executor are pinned to the node as a whole, not to one core each,
+//     so the OS can still balance them within the node
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    template <typename executor_t = executor>
+    class node_executors {
+    public:
+        // No threads per node means one thread per core of the node
+        explicit node_executors(size_t threads_per_node = 0) {
+            auto nodes{ numa_nodes() };
+            executors_.reserve(nodes.size());
+            for (size_t node{ 0 }; node < nodes.size(); ++node) {
+                for (auto core : nodes[node]) {
+                    if (core >= core_to_node_.size()) {
+                        core_to_node_.resize(core + 1, 0);
+                    }
+                    core_to_node_[core] = node;
+                }
+                auto number_of_threads{ threads_per_node != 0 ? threads_per_node : nodes[node].size() };
+                executors_.push_back(std::make_unique<executor_t>(number_of_threads, std::move(nodes[node])));
+            }
+        }
+
+        size_t size() const noexcept {
+            return executors_.size();
+        }
+        executor_t& get_executor(size_t node) noexcept {
+            return *executors_[node];
+        }
+        // The executor of the node the calling thread is running on, or of the first node if unknown
+        executor_t& local_executor() noexcept {
+            return *executors_[local_node()];
+        }
+        size_t local_node() const noexcept {
+            if (auto core{ current_core() }; core && *core < core_to_node_.size()) {
+                return core_to_node_[*core];
+            }
+            return 0;
+        }
+    private:
+        std::vector<std::unique_ptr<executor_t>> executors_;
+        std::vector<size_t> core_to_node_;
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,359 @@
+#pragma once
+
+#include "cancellation.h"  // cancelled, task_cancelled
+#include "ctask.h"
+#include "executor.h"  // DEFAULT_CONCURRENCY
+#include "waiter.h"
+
+#include <algorithm>  // max
+#include <atomic>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <cstdint>  // uintptr_t
+#include <deque>
+#include <exception>  // current_exception, exception_ptr, make_exception_ptr, rethrow_exception
+#include <functional>  // invoke
+#include <iterator>  // make_move_iterator
+#include <optional>
+#include <ranges>  // input_range, range_value_t
+#include <type_traits>  // conditional_t, invoke_result_t, is_void_v, remove_cvref_t
+#include <utility>  // forward, move
+#include <variant>  // monostate
+#include <vector>
+
+
+// parallel_for_each
+//
+// Iterating a generator runs every element's work on the thread that iterates it
+// parallel_for_each pulls the elements in batches instead, and runs every batch as a ctask, so the work is spread
+// over the executor's threads while the producer keeps on pulling:
+//
+//   co_await parallel_for_each(coro_sequence() | take(1'000'000), [](int i) { heavy(i); });
+//   std::vector<int> squares = co_await parallel_for_each(std::move(gen), [](int i) { return i * i; });
+//
+// If f returns a value, the task returns a vector with all the results, either
+//   - ordered: in the order of the elements, or
+//   - unordered: batch by batch, in the order the batches complete, which never waits on a slow batch
+//     while others are done
+//
+// Notes on implementation:
+//
+//   - The producer is a ctask itself; it only pulls a new batch once fewer than max_in_flight batches are running,
+//     which bounds both the memory in use and how far ahead of the consumers the generator runs
+//   - Ordered collection waits for the oldest batch; unordered collection pops the slots of completed batches from
+//     a completion queue, which every batch posts to once, so a completion costs the same whatever the window
+//     (see batch_window)
+//   - A batch never throws: it hands back its exception, so that the producer can stop pulling, wait for the batches
+//     still running, which use f, and only then rethrow the first exception
+//   - Cancelling the task stops the pulling; batches not started yet are skipped, and it rethrows task_cancelled
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    enum class result_order { ordered, unordered };
+
+    struct parallel_options {
+        size_t batch_size{ 256 };
+        size_t max_in_flight{ 2 * DEFAULT_CONCURRENCY };
+        result_order order{ result_order::ordered };
+    };
+
+
+    template <std::ranges::input_range range_t, typename F>
+    using parallel_invoke_result_t = std::remove_cvref_t<
+        std::invoke_result_t<const F&, std::ranges::range_value_t<range_t>&>>;
+
+    // void if f returns void, otherwise a vector of the results
+    template <std::ranges::input_range range_t, typename F>
+    using parallel_result_t = std::conditional_t<std::is_void_v<parallel_invoke_result_t<range_t, F>>,
+        void,
+        std::vector<parallel_invoke_result_t<range_t, F>>>;
+
+
+    // What a batch hands back to the producer
+    template <typename R>
+    struct batch_outcome {
+        std::vector<R> values;
+        std::exception_ptr exception;
+    };
+
+    template <>
+    struct batch_outcome<void> {
+        std::exception_ptr exception;
+    };
+
+
+    // Runs f on every element of a batch
+    // f lives in the producer's frame, which outlives every batch
+    template <is_executor_provider executor_provider_t, typename T, typename F>
+    ctask<batch_outcome<std::remove_cvref_t<std::invoke_result_t<const F&, T&>>>, executor_provider_t>
+    run_batch(std::vector<T> batch, const F& f) {
+        using result_type = std::remove_cvref_t<std::invoke_result_t<const F&, T&>>;
+        batch_outcome<result_type> outcome{};
+        try {
+            if constexpr (std::is_void_v<result_type>) {
+                for (auto& e : batch) {
+                    std::invoke(f, e);
+                }
+            } else {
+                outcome.values.reserve(batch.size());
+                for (auto& e : batch) {
+                    outcome.values.push_back(std::invoke(f, e));
+                }
+            }
+        } catch (...) {
+            outcome.exception = std::current_exception();
+        }
+        co_return std::move(outcome);
+    }
+
+    // Batch window
+    // The batches in flight, each in a slot of its own, and the completion queue of the unordered collection
+    //
+    // Every batch registers a single completion node, when it's pushed, whose on_ready hook posts the batch's slot onto
+    // the queue, a lock-free stack: a completion costs one CAS, whatever the number of batches in flight
+    // The producer takes the whole stack at once, and waits, as a waiter (see waiter.h), only when it's empty
+    // Ordered collection waits on the oldest batch instead, and registers no completion nodes
+    // Only the producer pushes and completes batches
+    template <is_task batch_task_t>
+    class batch_window {
+        using outcome_type = typename batch_task_t::result_type;
+
+        class completion_node : public continuation {
+        public:
+            batch_window* window_{};
+            size_t slot_{};
+        };
+    public:
+        batch_window(size_t capacity, result_order order)
+            : slots_(capacity)
+            , nodes_(capacity)
+            , order_{ order } {
+            free_.reserve(capacity);
+            for (size_t i{ capacity }; i > 0; --i) {
+                free_.push_back(i - 1);
+            }
+        }
+        batch_window(const batch_window&) = delete;
+        batch_window& operator=(const batch_window&) = delete;
+
+        size_t size() const noexcept {
+            return slots_.size() - free_.size();
+        }
+        bool empty() const noexcept {
+            return free_.size() == slots_.size();
+        }
+        bool full() const noexcept {
+            return free_.empty();
+        }
+        void push(batch_task_t task) {
+            auto slot{ free_.back() };
+            free_.pop_back();
+            slots_[slot].emplace(std::move(task));
+            if (order_ == result_order::ordered) {
+                fifo_.push_back(slot);
+                return;
+            }
+            auto& node{ nodes_[slot] };
+            node.window_ = this;
+            node.slot_ = slot;
+            node.on_ready_ = &batch_window::on_ready;
+            if (not slots_[slot]->register_continuation(node)) {
+                ready_.push_back(slot);
+            }
+        }
+        // co_await complete_one() returns the outcome of the oldest batch, or of any completed batch,
+        // and frees its slot
+        // A batch only throws if it has been cancelled before it ran, and then that is its outcome
+        auto complete_one() noexcept {
+            return complete_awaitable{ *this };
+        }
+    private:
+        static constexpr std::uintptr_t empty_queue = 0;
+        static constexpr std::uintptr_t producer_waiting = 1;
+
+        static_assert(alignof(continuation) > producer_waiting);
+
+        // Pushes the batch's slot, and resumes the producer if it's waiting for one
+        static std::coroutine_handle<> on_ready(continuation& c) noexcept {
+            auto& node{ static_cast<completion_node&>(c) };
+            auto& self{ *node.window_ };
+            auto state{ self.completed_.load(std::memory_order_relaxed) };
+            do {
+                node.next_ = state == producer_waiting ? nullptr : reinterpret_cast<continuation*>(state);
+            } while (not self.completed_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(&node),
+                std::memory_order_acq_rel, std::memory_order_relaxed));
+            if (state == producer_waiting) {
+                resume_waiter(self.waiter_);
+            }
+            return nullptr;
+        }
+        // Moves the completed slots posted so far to the producer's own list
+        void take_completed() noexcept {
+            if (completed_.load(std::memory_order_relaxed) == empty_queue) {
+                return;
+            }
+            // Reverse the stack, so that batches are collected in the order they completed
+            auto pushed{ reinterpret_cast<continuation*>(completed_.exchange(empty_queue, std::memory_order_acquire)) };
+            continuation* oldest{};
+            while (pushed != nullptr) {
+                auto next{ pushed->next_ };
+                pushed->next_ = oldest;
+                oldest = pushed;
+                pushed = next;
+            }
+            for (; oldest != nullptr; oldest = oldest->next_) {
+                ready_.push_back(static_cast<completion_node*>(oldest)->slot_);
+            }
+        }
+        bool oldest_ready() const {
+            return slots_[fifo_.front()]->ready();
+        }
+        outcome_type take(size_t slot) {
+            outcome_type outcome{};
+            try {
+                outcome = slots_[slot]->get_result();
+            } catch (...) {
+                outcome.exception = std::current_exception();
+            }
+            slots_[slot].reset();
+            free_.push_back(slot);
+            return outcome;
+        }
+
+        class complete_awaiter {
+        public:
+            explicit complete_awaiter(batch_window& window) noexcept
+                : window_{ &window }
+            {}
+            bool await_ready() {
+                if (window_->order_ == result_order::ordered) {
+                    return window_->oldest_ready();
+                }
+                window_->take_completed();
+                return not window_->ready_.empty();
+            }
+            // Returns false if a batch completed in the meantime
+            template <typename promise_t>
+            bool await_suspend(std::coroutine_handle<promise_t> handle) {
+                prepare_waiter(window_->waiter_, handle);
+                if (window_->order_ == result_order::ordered) {
+                    return window_->slots_[window_->fifo_.front()]->register_continuation(window_->waiter_);
+                }
+                auto expected{ empty_queue };
+                return window_->completed_.compare_exchange_strong(expected, producer_waiting,
+                    std::memory_order_acq_rel, std::memory_order_relaxed);
+            }
+            outcome_type await_resume() {
+                size_t slot{};
+                if (window_->order_ == result_order::ordered) {
+                    slot = window_->fifo_.front();
+                    window_->fifo_.pop_front();
+                } else {
+                    window_->take_completed();
+                    slot = window_->ready_.front();
+                    window_->ready_.pop_front();
+                }
+                return window_->take(slot);
+            }
+        private:
+            batch_window* window_;
+        };
+
+        class complete_awaitable {
+        public:
+            explicit complete_awaitable(batch_window& window) noexcept
+                : window_{ &window }
+            {}
+            auto operator co_await() const noexcept {
+                return complete_awaiter{ *window_ };
+            }
+        private:
+            batch_window* window_;
+        };
+
+        std::vector<std::optional<batch_task_t>> slots_;
+        std::vector<completion_node> nodes_;
+        std::vector<size_t> free_;
+        result_order order_;
+        std::deque<size_t> fifo_;  // ordered: slots from the oldest batch to the newest
+        std::deque<size_t> ready_;  // unordered: slots of completed batches, taken from the queue
+        std::atomic<std::uintptr_t> completed_{ empty_queue };  // unordered: empty, producer waiting, or a node stack
+        continuation waiter_{};
+    };
+
+
+    template <is_executor_provider executor_provider_t = ctask_executor_provider, std::ranges::input_range range_t, typename F>
+    ctask<parallel_result_t<range_t, F>, executor_provider_t> parallel_for_each(range_t range, F f, parallel_options options = {}) {
+        using element_type = std::ranges::range_value_t<range_t>;
+        using result_type = parallel_invoke_result_t<range_t, F>;
+        using batch_task = ctask<batch_outcome<result_type>, executor_provider_t>;
+        constexpr bool has_results{ not std::is_void_v<result_type> };
+
+        const auto batch_size{ std::max<size_t>(options.batch_size, 1) };
+        const auto max_in_flight{ std::max<size_t>(options.max_in_flight, 1) };
+
+        std::conditional_t<has_results, std::vector<result_type>, std::monostate> results;
+        std::exception_ptr exception;
+        batch_window<batch_task> in_flight{ max_in_flight, options.order };
+
+        auto collect = [&results, &exception](batch_outcome<result_type> outcome) {
+            if (outcome.exception) {
+                if (not exception) {
+                    exception = std::move(outcome.exception);
+                }
+            } else if constexpr (has_results) {
+                results.insert(results.end(),
+                    std::make_move_iterator(outcome.values.begin()), std::make_move_iterator(outcome.values.end()));
+            }
+        };
+
+        std::vector<element_type> batch;
+        batch.reserve(batch_size);
+        try {
+            for (auto&& e : range) {
+                batch.push_back(std::forward<decltype(e)>(e));
+                if (batch.size() < batch_size) {
+                    continue;
+                }
+                // Stop pulling once cancelled; the batches in flight are cancelled too
+                if (auto stop{ co_await cancelled() }; stop) {
+                    exception = std::make_exception_ptr(task_cancelled{});
+                    break;
+                }
+                // Backpressure: wait for a batch to complete before pulling any further
+                if (in_flight.full()) {
+                    collect(co_await in_flight.complete_one());
+                    if (exception) {
+                        break;
+                    }
+                }
+                in_flight.push(run_batch<executor_provider_t>(std::move(batch), f));
+                batch = {};
+                batch.reserve(batch_size);
+            }
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        if (not exception && not batch.empty()) {
+            if (in_flight.full()) {
+                collect(co_await in_flight.complete_one());
+            }
+            if (not exception) {
+                in_flight.push(run_batch<executor_provider_t>(std::move(batch), f));
+            }
+        }
+
+        // Wait for every batch still running, in order for ordered collection
+        while (not in_flight.empty()) {
+            collect(co_await in_flight.complete_one());
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        if constexpr (has_results) {
+            co_return std::move(results);
+        } else {
+            co_return;
+        }
+    }
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "frame_pool.h"
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <exception>  // current_exception, exception_ptr, rethrow_exception
+#include <functional>  // reference_wrapper
+#include <optional>
+#include <type_traits>  // conditional_t, is_reference_v, remove_reference_t
+#include <utility>  // exchange, forward, move
+
+
+// Lazy task
+//
+// A ctask is eager: it is scheduled on an executor at initial_suspend, which costs a thread hop
+// even when the task is co_awaited right away
+// A lazy task does not start until it is co_awaited, and then it runs inline on the awaiter's thread:
+//   - co_await transfers control to the task (symmetric transfer)
+//   - the task's final_suspend transfers control back to the awaiter
+// No executor, no shared state, and no atomic operations are involved
+//
+// Lazy tasks can co_await ctasks (their continuation is then scheduled on the ctask's executor), and ctasks can co_await lazy tasks
+// Use ctask for real fan-out, and task for subtasks that are co_awaited immediately
+//
+// E.g.
+//   task<int> mul(int a, int b) { co_return a * b; }
+//   ctask<int> mul_add(int a, int b, int c, int d) { co_return co_await mul(a, b) + co_await mul(c, d); }
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    template <typename result_t>
+    class task;
+
+
+    // Lazy task promise base
+    // Keeps the continuation, i.e. the awaiter, and transfers control back to it at final_suspend
+    class task_promise_base {
+    public:
+        // Coroutine frames are recycled through the frame pool
+        static void* operator new(std::size_t size) {
+            return frame_pool::allocate(size);
+        }
+        static void operator delete(void* ptr, std::size_t size) noexcept {
+            frame_pool::deallocate(ptr, size);
+        }
+        auto initial_suspend() noexcept {
+            return std::suspend_always{};
+        }
+        auto final_suspend() noexcept {
+            return final_awaiter{};
+        }
+        void unhandled_exception() noexcept {
+            exception_ = std::current_exception();
+        }
+        void set_continuation(std::coroutine_handle<> continuation) noexcept {
+            continuation_ = continuation;
+        }
+    protected:
+        void rethrow_if_exception() const {
+            if (exception_) {
+                std::rethrow_exception(exception_);
+            }
+        }
+    private:
+        struct final_awaiter : public std::suspend_always {
+            template <typename promise_t>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) const noexcept {
+                if (auto continuation{ handle.promise().continuation_ }) {
+                    return continuation;
+                }
+                return std::noop_coroutine();
+            }
+        };
+
+        std::coroutine_handle<> continuation_;
+        std::exception_ptr exception_;
+    };
+
+
+    // Lazy task promise
+    template <typename result_t>
+    class task_promise : public task_promise_base {
+    public:
+        task<result_t> get_return_object() noexcept;
+        void return_value(result_t&& value) {
+            if constexpr (std::is_reference_v<result_t>) {
+                value_.emplace(value);
+            } else {
+                value_.emplace(std::forward<result_t>(value));
+            }
+        }
+        result_t get_result() {
+            rethrow_if_exception();
+            if constexpr (std::is_reference_v<result_t>) {
+                return static_cast<result_t>(value_->get());
+            } else {
+                return std::move(*value_);
+            }
+        }
+    private:
+        using value_type = std::conditional_t<std::is_reference_v<result_t>,
+            std::reference_wrapper<std::remove_reference_t<result_t>>,
+            result_t>;
+
+        std::optional<value_type> value_;
+    };
+
+    template <>
+    class task_promise<void> : public task_promise_base {
+    public:
+        task<void> get_return_object() noexcept;
+        void return_void() noexcept {}
+        void get_result() const {
+            rethrow_if_exception();
+        }
+    };
+
+
+    // Lazy task
+    // Owns the coroutine frame
+    template <typename result_t>
+    class task {
+    public:
+        using promise_type = task_promise<result_t>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        task(task&& other) noexcept
+            : handle_{ std::exchange(other.handle_, nullptr) }
+        {}
+        task& operator=(task&& other) noexcept {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+        ~task() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        // A lazy task can be co_awaited only once
+        auto operator co_await() noexcept {
+            return awaiter{ handle_ };
+        }
+    private:
+        friend promise_type;
+
+        class awaiter {
+        public:
+            // A moved-from task has no coroutine to await
+            bool await_ready() const noexcept {
+                assert(handle_ && "co_await on a moved-from task");
+                return handle_.done();
+            }
+            // Start the task inline, on the awaiter's thread
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                handle_.promise().set_continuation(continuation);
+                return handle_;
+            }
+            decltype(auto) await_resume() {
+                return handle_.promise().get_result();
+            }
+
+            handle_type handle_;
+        };
+
+        explicit task(handle_type handle) noexcept
+            : handle_{ handle }
+        {}
+
+        handle_type handle_;
+    };
+
+
+    template <typename result_t>
+    task<result_t> task_promise<result_t>::get_return_object() noexcept {
+        return task<result_t>{ task<result_t>::handle_type::from_promise(*this) };
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept {
+        return task<void>{ task<void>::handle_type::from_promise(*this) };
+    }
+}  // namespace rtc::coro::mpp_mcpp::v4d
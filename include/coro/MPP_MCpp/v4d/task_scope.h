@@ -0,0 +1,155 @@
+#pragma once
+
+#include "ctask.h"
+#include "task_slab.h"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <functional>  // invoke
+#include <mutex>  // lock_guard, mutex, unique_lock
+#include <type_traits>  // invoke_result_t, remove_cvref_t
+#include <utility>  // exchange, forward
+
+
+// Task scope
+//
+// A nursery for child tasks whose lifetimes are strictly nested in their parent's:
+//
+//   ctask<int> mul_add(int a, int b, int c, int d) {
+//       task_scope scope;
+//       auto p1{ scope.spawn(mul, a, b) };
+//       auto p2{ scope.spawn(mul, c, d) };
+//       co_await scope.join();
+//       co_return p1.get_result() + p2.get_result();
+//   }
+//
+// A ctask keeps its state behind a shared pointer, so that any copy of the task can outlive the coroutine
+// Spawned tasks can't outlive their scope, so their states are allocated in the scope's slab instead, and the tasks
+// only hold non-owning pointers to them: copying, awaiting, and completing a spawned task touches no reference count
+//
+// Notes on implementation:
+//
+//   - spawn(f, args...) calls f(args...), which has to create the ctask then, and no other, so that the promise can
+//     take the scope's slab for its state; a debug build asserts it did
+//     The slab is only current for the call, even if f throws, so a ctask created afterwards never takes it
+//   - Every spawned task gets a join node, a continuation in the slab, that counts down the tasks still running;
+//     the count starts at one, which join releases, so that only the last task to complete during a join resumes
+//     the parent, and join can't miss a task
+//   - The parent can't leave the scope before its children complete: destroying a scope with children still running,
+//     e.g. because the parent throws before it co_awaits join(), asserts in a debug build
+//     Otherwise the destructor blocks on a condition variable, which the last child notifies under the lock, so that
+//     the scope isn't destroyed before the child is done with it; that holds an executor thread, and deadlocks if the
+//     children are queued behind the parent on a single thread, so a parent that can throw joins in its handler
+//   - Only the parent spawns and joins; tasks created by a spawned task must complete within it, e.g. be awaited
+//   - A scope can be reused after a join: the first spawn after it resets the slab, destroying the states of the tasks
+//     spawned before the join, so their results have to be read before then; a scope that spawns and joins in a loop
+//     keeps reusing the same blocks
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    class task_scope {
+        class join_node : public continuation {
+        public:
+            task_scope* scope_{};
+        };
+    public:
+        task_scope() = default;
+        task_scope(const task_scope&) = delete;
+        task_scope& operator=(const task_scope&) = delete;
+        ~task_scope() {
+            auto running{ pending_.load(std::memory_order_acquire) != 1 };
+            assert(not running && "task_scope destroyed with children still running; co_await join() first");
+            if (running && pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                std::unique_lock lock{ mutex_ };
+                completed_.wait(lock, [this]() { return done_; });
+            }
+        }
+
+        template <typename F, typename... Args>
+            requires is_task<std::remove_cvref_t<std::invoke_result_t<F, Args...>>>
+        auto spawn(F&& f, Args&&... args) {
+            if (std::exchange(joined_, false)) {
+                slab_.reset();
+            }
+            auto task{ [&]() {
+                task_slab::current_scope current{ slab_ };
+                return std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+            }() };
+            assert(task.has_newest_state_in(slab_) && "spawn(f) where f doesn't create the task it returns, or creates others");
+            auto& node{ slab_.make<join_node>() };
+            node.scope_ = this;
+            node.on_ready_ = &task_scope::on_ready;
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            if (not task.register_continuation(node)) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            return task;
+        }
+
+        // co_await join() resumes the parent once every task spawned so far has completed
+        auto join() noexcept {
+            return join_awaitable{ *this };
+        }
+    private:
+        class join_awaitable {
+        public:
+            explicit join_awaitable(task_scope& scope) noexcept
+                : scope_{ &scope }
+            {}
+            auto operator co_await() const noexcept {
+                return join_awaiter{ *scope_ };
+            }
+        private:
+            task_scope* scope_;
+        };
+
+        class join_awaiter {
+        public:
+            explicit join_awaiter(task_scope& scope) noexcept
+                : scope_{ &scope }
+            {}
+            bool await_ready() const noexcept {
+                return scope_->pending_.load(std::memory_order_acquire) == 1;
+            }
+            bool await_suspend(std::coroutine_handle<> handle) const noexcept {
+                scope_->parent_ = handle;
+                return scope_->pending_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+            void await_resume() const noexcept {
+                scope_->pending_.store(1, std::memory_order_relaxed);
+                scope_->parent_ = nullptr;
+                scope_->joined_ = true;
+            }
+        private:
+            task_scope* scope_;
+        };
+
+        // The count only drops to zero during a join or the destructor, so a task that doesn't complete it never reads
+        // the scope again, which the destructor may be about to destroy
+        // The destructor leaves parent_ null, and waits for done_
+        static std::coroutine_handle<> on_ready(continuation& c) noexcept {
+            auto& self{ *static_cast<join_node&>(c).scope_ };
+            if (self.pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return nullptr;
+            }
+            if (self.parent_) {
+                return self.parent_;
+            }
+            std::lock_guard lock{ self.mutex_ };
+            self.done_ = true;
+            self.completed_.notify_one();
+            return nullptr;
+        }
+
+        task_slab slab_;
+        std::atomic<std::size_t> pending_{ 1 };
+        std::coroutine_handle<> parent_;
+        bool joined_{};
+        std::mutex mutex_;
+        std::condition_variable completed_;
+        bool done_{};
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>  // max
+#include <cstddef>  // byte, max_align_t, size_t
+#include <memory>  // align
+#include <new>  // align_val_t, operator delete, operator new
+#include <utility>  // exchange, forward
+#include <vector>
+
+
+// Task slab
+//
+// Bump allocator for the shared states of the tasks spawned in a task scope, see task_scope.h
+// Objects are never freed one by one: they are all destroyed, newest first, together with the slab, or by reset,
+// which keeps the blocks for the next objects
+//
+// Notes on implementation:
+//
+//   - Memory comes in blocks of block_size bytes, aligned to a cache line; bigger objects get a block of their own
+//   - After a reset, blocks are reused in order, and one too small for the next object is replaced, so a slab that
+//     is reset over and over holds about as much memory as its biggest round took
+//   - Every object is preceded by an entry, which links to the previous object, and knows how to destroy it
+//   - current() is the slab the next ctask created on this thread gets its state from, if any;
+//     the ctask promise takes it, so it only ever applies to one task
+//     current_scope sets it for a scope, and restores the previous one on the way out, even if an exception is thrown
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    class task_slab {
+    public:
+        static constexpr std::size_t block_size = 4096;
+        static constexpr std::size_t block_alignment = 64;
+
+        task_slab() = default;
+        task_slab(const task_slab&) = delete;
+        task_slab& operator=(const task_slab&) = delete;
+        ~task_slab() {
+            destroy_objects();
+            for (auto& b : blocks_) {
+                ::operator delete(b.data_, b.size_, std::align_val_t{ block_alignment });
+            }
+        }
+
+        template <typename T, typename... Args>
+        T& make(Args&&... args) {
+            auto e{ static_cast<entry*>(allocate(sizeof(entry), alignof(entry))) };
+            auto object{ new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...) };
+            *e = entry{ last_, object, [](void* p) noexcept { static_cast<T*>(p)->~T(); } };
+            last_ = e;
+            return *object;
+        }
+
+        // Destroys every object, newest first, and rewinds to the first block
+        void reset() noexcept {
+            destroy_objects();
+            block_ = 0;
+            cursor_ = nullptr;
+            space_ = 0;
+        }
+
+        // Whether object is the last one made in this slab
+        bool is_newest(const void* object) const noexcept {
+            return last_ != nullptr && last_->object_ == object;
+        }
+
+        static task_slab*& current() noexcept {
+            static thread_local task_slab* slab{};
+            return slab;
+        }
+
+        class current_scope {
+        public:
+            explicit current_scope(task_slab& slab) noexcept
+                : previous_{ std::exchange(current(), &slab) }
+            {}
+            current_scope(const current_scope&) = delete;
+            current_scope& operator=(const current_scope&) = delete;
+            ~current_scope() {
+                current() = previous_;
+            }
+        private:
+            task_slab* previous_;
+        };
+    private:
+        struct entry {
+            entry* previous_;
+            void* object_;
+            void (*destroy_)(void*) noexcept;
+        };
+        struct block {
+            std::byte* data_;
+            std::size_t size_;
+        };
+
+        void destroy_objects() noexcept {
+            for (auto e{ std::exchange(last_, nullptr) }; e != nullptr; ) {
+                auto previous{ e->previous_ };
+                e->destroy_(e->object_);
+                e = previous;
+            }
+        }
+
+        void* allocate(std::size_t size, std::size_t alignment) {
+            void* p{ cursor_ };
+            if (cursor_ == nullptr || not std::align(alignment, size, p, space_)) {
+                auto n{ std::max(block_size, size + alignment) };
+                auto next{ cursor_ == nullptr ? block_ : block_ + 1 };
+                if (next == blocks_.size() || blocks_[next].size_ < n) {
+                    if (next == blocks_.size()) {
+                        blocks_.reserve(next + 1);
+                    }
+                    auto data{ static_cast<std::byte*>(::operator new(n, std::align_val_t{ block_alignment })) };
+                    if (next == blocks_.size()) {
+                        blocks_.push_back(block{ data, n });
+                    } else {
+                        auto& b{ blocks_[next] };
+                        ::operator delete(b.data_, b.size_, std::align_val_t{ block_alignment });
+                        b = block{ data, n };
+                    }
+                }
+                block_ = next;
+                p = blocks_[next].data_;
+                space_ = blocks_[next].size_;
+                std::align(alignment, size, p, space_);
+            }
+            cursor_ = static_cast<std::byte*>(p) + size;
+            space_ -= size;
+            return p;
+        }
+
+        std::vector<block> blocks_;
+        std::size_t block_{};  // index of the block cursor_ is in
+        std::byte* cursor_{};
+        std::size_t space_{};
+        entry* last_{};
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ctask.h"
+#include "executor.h"
+
+#include <concepts>  // convertible_to
+#include <coroutine>
+#include <utility>  // exchange
+
+
+// Waiter
+//
+// A coroutine suspended on one of the async synchronization primitives, async_mutex, async_semaphore, and channel,
+// is a continuation: an intrusive list node owned by its awaiter, so waiting never allocates
+//
+// Notes on implementation:
+//
+//   - A ctask waiter is resumed on its task's executor, as the continuations of the tasks it co_awaits are;
+//     any other coroutine, e.g. a lazy task awaited outside of a ctask, is resumed inline by whoever wakes it up
+//   - Waking up a waiter only schedules it, so a primitive can do it right after releasing its own lock, if any,
+//     without running user code on the releaser's stack
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    template <typename promise_t>
+    void prepare_waiter(continuation& waiter, std::coroutine_handle<promise_t> handle) noexcept {
+        waiter.handle_ = handle;
+        waiter.next_ = nullptr;
+        if constexpr (requires (promise_t& p) { { p.get_executor() } -> std::convertible_to<executor_interface&>; }) {
+            waiter.executor_ = &handle.promise().get_executor();
+        }
+    }
+
+    // The waiter's node can be gone as soon as it is scheduled, so nothing is read from it afterwards
+    inline void resume_waiter(continuation& waiter) {
+        auto handle{ waiter.handle_ };
+        if (auto executor{ waiter.executor_ }) {
+            executor->schedule(work_item{ handle, waiter.priority_, work_kind::resume });
+        } else {
+            handle.resume();
+        }
+    }
+
+    // Resumes every waiter of a list, e.g. one taken from a waiter queue
+    inline void resume_waiters(continuation* waiters) {
+        while (waiters != nullptr) {
+            auto next{ waiters->next_ };
+            resume_waiter(*waiters);
+            waiters = next;
+        }
+    }
+
+
+    // Waiter queue
+    // FIFO of waiters, for primitives that keep them under a lock
+    class waiter_queue {
+    public:
+        bool empty() const noexcept {
+            return head_ == nullptr;
+        }
+        void push_back(continuation& waiter) noexcept {
+            waiter.next_ = nullptr;
+            (tail_ ? tail_->next_ : head_) = &waiter;
+            tail_ = &waiter;
+        }
+        continuation* pop_front() noexcept {
+            auto waiter{ head_ };
+            if (waiter) {
+                head_ = waiter->next_;
+                tail_ = head_ ? tail_ : nullptr;
+            }
+            return waiter;
+        }
+        // The whole queue, as a list linked through next_
+        continuation* take_all() noexcept {
+            tail_ = nullptr;
+            return std::exchange(head_, nullptr);
+        }
+    private:
+        continuation* head_{};
+        continuation* tail_{};
+    };
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,329 @@
+#pragma once
+
+#include "ctask.h"
+
+#include <algorithm>  // all_of, for_each, transform
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <iterator>  // back_inserter
+#include <limits>  // numeric_limits
+#include <tuple>
+#include <type_traits>  // conditional_t, is_void_v, remove_cvref_t
+#include <utility>  // index_sequence, move
+#include <variant>  // monostate
+#include <vector>
+
+
+// when_all and when_any
+//
+// co_awaiting several tasks one after the other pays one await_ready/register/resume cycle per task
+// Instead, when_all registers one continuation per task, all of them pointing to a single atomic countdown,
+// and the parent coroutine is resumed exactly once, by the task that brings the countdown to zero
+// when_any resumes the parent on the first completion
+//
+// E.g.
+//   auto [v1, v2] = co_await when_all(mul(a, b), mul(c, d));
+//   std::vector<int> vs = co_await when_all(std::move(tasks));
+//   std::size_t first = co_await when_any(std::move(tasks));
+//
+// Notes on implementation:
+//
+//   - The countdown starts at the number of tasks plus one, the extra one being released once all the continuations
+//     are registered, so that the parent can't be resumed while await_suspend is still running
+//   - A task that has already completed doesn't accept the registration, and just counts down on the spot
+//   - when_any returns the index of the first completed task; the other tasks keep on running, so their continuations
+//     live in a shared block that is freed when the last of the tasks completes
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    // void results are returned as std::monostate
+    template <is_task task_t>
+    using when_all_result_t = std::conditional_t<std::is_void_v<typename task_t::result_type>,
+        std::monostate,
+        typename task_t::result_type>;
+
+    template <is_task task_t>
+    when_all_result_t<task_t> get_when_all_result(const task_t& task) {
+        if constexpr (std::is_void_v<typename task_t::result_type>) {
+            task.get_result();
+            return {};
+        } else {
+            return task.get_result();
+        }
+    }
+
+
+    // Countdown
+    // Shared by all the continuations of a when_all
+    class when_all_countdown {
+    public:
+        class node : public continuation {
+        public:
+            when_all_countdown* countdown_{};
+        };
+
+        explicit when_all_countdown(size_t count) noexcept
+            : count_{ count + 1 }
+        {}
+        // Registers one continuation per task, and returns false if all of them have already completed
+        bool arm(auto&& tasks, auto& nodes, std::coroutine_handle<> parent) noexcept {
+            parent_ = parent;
+            size_t i{ 0 };
+            auto register_one = [this, &nodes, &i](auto& task) {
+                auto& n{ nodes[i++] };
+                n.countdown_ = this;
+                n.on_ready_ = &when_all_countdown::on_ready;
+                if (not task.register_continuation(n)) {
+                    count_.fetch_sub(1, std::memory_order_acq_rel);
+                }
+            };
+            if constexpr (requires { std::tuple_size<std::remove_cvref_t<decltype(tasks)>>::value; }) {
+                std::apply([&register_one](auto&... ts) { (register_one(ts), ...); }, tasks);
+            } else {
+                for (auto& task : tasks) {
+                    register_one(task);
+                }
+            }
+            return count_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+    private:
+        static std::coroutine_handle<> on_ready(continuation& c) noexcept {
+            auto& self{ *static_cast<node&>(c).countdown_ };
+            if (self.count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                return self.parent_;
+            }
+            return nullptr;
+        }
+
+        std::atomic<size_t> count_;
+        std::coroutine_handle<> parent_;
+    };
+
+
+    // when_all for a fixed number of tasks
+    // co_await returns a tuple with all the results
+    template <is_task... tasks_t>
+    class when_all_awaitable {
+    public:
+        explicit when_all_awaitable(tasks_t... tasks)
+            : tasks_{ std::move(tasks)... }
+        {}
+        auto operator co_await() && {
+            return awaiter{ std::move(tasks_) };
+        }
+    private:
+        class awaiter {
+        public:
+            explicit awaiter(std::tuple<tasks_t...> tasks)
+                : tasks_{ std::move(tasks) }
+            {}
+            bool await_ready() const noexcept {
+                return std::apply([](const auto&... ts) { return (ts.ready() && ...); }, tasks_);
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return countdown_.arm(tasks_, nodes_, handle);
+            }
+            auto await_resume() const {
+                return std::apply([](const auto&... ts) {
+                    return std::tuple<when_all_result_t<tasks_t>...>{ get_when_all_result(ts)... };
+                }, tasks_);
+            }
+        private:
+            std::tuple<tasks_t...> tasks_;
+            std::array<when_all_countdown::node, sizeof...(tasks_t)> nodes_{};
+            when_all_countdown countdown_{ sizeof...(tasks_t) };
+        };
+
+        std::tuple<tasks_t...> tasks_;
+    };
+
+
+    // when_all for a range of tasks
+    // co_await returns a vector with all the results, in the same order as the tasks
+    template <is_task task_t>
+    class when_all_range_awaitable {
+    public:
+        explicit when_all_range_awaitable(std::vector<task_t> tasks)
+            : tasks_{ std::move(tasks) }
+        {}
+        auto operator co_await() && {
+            return awaiter{ std::move(tasks_) };
+        }
+    private:
+        class awaiter {
+        public:
+            explicit awaiter(std::vector<task_t> tasks)
+                : tasks_{ std::move(tasks) }
+                , nodes_(tasks_.size())
+                , countdown_{ tasks_.size() }
+            {}
+            bool await_ready() const noexcept {
+                return std::ranges::all_of(tasks_, [](const auto& t) { return t.ready(); });
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return countdown_.arm(tasks_, nodes_, handle);
+            }
+            auto await_resume() const {
+                if constexpr (std::is_void_v<typename task_t::result_type>) {
+                    std::ranges::for_each(tasks_, [](const auto& t) { t.get_result(); });
+                } else {
+                    std::vector<typename task_t::result_type> results;
+                    results.reserve(tasks_.size());
+                    std::ranges::transform(tasks_, std::back_inserter(results), [](const auto& t) { return t.get_result(); });
+                    return results;
+                }
+            }
+        private:
+            std::vector<task_t> tasks_;
+            std::vector<when_all_countdown::node> nodes_;
+            when_all_countdown countdown_;
+        };
+
+        std::vector<task_t> tasks_;
+    };
+
+
+    template <is_task... tasks_t>
+    auto when_all(tasks_t... tasks) {
+        return when_all_awaitable<tasks_t...>{ std::move(tasks)... };
+    }
+
+    template <is_task task_t>
+    auto when_all(std::vector<task_t> tasks) {
+        return when_all_range_awaitable<task_t>{ std::move(tasks) };
+    }
+
+
+    // when_any shared block
+    // Owns copies of the tasks and their continuations, and lives until the last task completes
+    template <is_task task_t>
+    class when_any_block {
+    public:
+        static constexpr size_t no_winner = std::numeric_limits<size_t>::max();
+
+        class node : public continuation {
+        public:
+            when_any_block* block_{};
+            size_t index_{};
+        };
+
+        explicit when_any_block(std::vector<task_t> tasks)
+            : tasks_{ std::move(tasks) }
+            , nodes_(tasks_.size())
+            , references_{ tasks_.size() + 1 }
+        {}
+        // Returns false if a task has already completed
+        bool arm(std::coroutine_handle<> parent) noexcept {
+            parent_ = parent;
+            for (size_t i{ 0 }; i < tasks_.size(); ++i) {
+                auto& n{ nodes_[i] };
+                n.block_ = this;
+                n.index_ = i;
+                n.on_ready_ = &when_any_block::on_ready;
+                if (not tasks_[i].register_continuation(n)) {
+                    // The task won't call on_ready, so do its work here, without resuming the parent
+                    try_win(i);
+                    release();
+                }
+            }
+            // The parent is resumed by whoever comes second: the first task to complete, or the end of arm
+            return armed_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+        bool empty() const noexcept {
+            return tasks_.empty();
+        }
+        size_t winner() const noexcept {
+            return winner_.load(std::memory_order_acquire);
+        }
+        void release() noexcept {
+            if (references_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+    private:
+        bool try_win(size_t index) noexcept {
+            auto expected{ no_winner };
+            if (winner_.compare_exchange_strong(expected, index, std::memory_order_acq_rel)) {
+                armed_.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+            return false;
+        }
+        static std::coroutine_handle<> on_ready(continuation& c) noexcept {
+            auto& n{ static_cast<node&>(c) };
+            auto& self{ *n.block_ };
+            std::coroutine_handle<> ret{};
+            auto expected{ no_winner };
+            if (self.winner_.compare_exchange_strong(expected, n.index_, std::memory_order_acq_rel) &&
+                self.armed_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                ret = self.parent_;
+            }
+            self.release();
+            return ret;
+        }
+
+        std::vector<task_t> tasks_;
+        std::vector<node> nodes_;
+        std::atomic<size_t> references_;  // one per registered task, plus one for the awaiter
+        std::atomic<size_t> armed_{ 2 };  // one for the first completion, plus one for the end of arm
+        std::atomic<size_t> winner_{ no_winner };
+        std::coroutine_handle<> parent_;
+    };
+
+
+    // when_any for a range of tasks
+    // co_await returns the index of the first task to complete
+    template <is_task task_t>
+    class when_any_awaitable {
+    public:
+        explicit when_any_awaitable(std::vector<task_t> tasks)
+            : tasks_{ std::move(tasks) }
+        {}
+        auto operator co_await() && {
+            return awaiter{ std::move(tasks_) };
+        }
+    private:
+        class awaiter {
+        public:
+            explicit awaiter(std::vector<task_t> tasks)
+                : block_{ new when_any_block<task_t>{ std::move(tasks) } }
+            {}
+            awaiter(const awaiter&) = delete;
+            awaiter& operator=(const awaiter&) = delete;
+            ~awaiter() {
+                block_->release();
+            }
+            // There is nothing to wait for with no tasks, and then the winner is no_winner
+            bool await_ready() const noexcept {
+                return block_->empty();
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return block_->arm(handle);
+            }
+            size_t await_resume() const noexcept {
+                return block_->winner();
+            }
+        private:
+            when_any_block<task_t>* block_;
+        };
+
+        std::vector<task_t> tasks_;
+    };
+
+
+    template <is_task task_t>
+    auto when_any(std::vector<task_t> tasks) {
+        return when_any_awaitable<task_t>{ std::move(tasks) };
+    }
+
+    template <is_task task_t, std::same_as<task_t>... tasks_t>
+    auto when_any(task_t task, tasks_t... tasks) {
+        std::vector<task_t> v;
+        v.reserve(1 + sizeof...(tasks_t));
+        v.push_back(std::move(task));
+        (v.push_back(std::move(tasks)), ...);
+        return when_any_awaitable<task_t>{ std::move(v) };
+    }
+}  // namespace rtc::coro::mpp_mcpp::v4d
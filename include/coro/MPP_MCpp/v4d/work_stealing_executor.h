@@ -0,0 +1,250 @@
+#pragma once
+
+#include "executor.h"
+
+#include <algorithm>  // for_each
+#include <atomic>
+#include <condition_variable>  // condition_variable_any
+#include <cstdint>  // uint64_t
+#include <functional>  // bind_front
+#include <memory>  // make_unique, unique_ptr
+#include <mutex>  // lock_guard, unique_lock
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>  // jthread
+#include <utility>  // move
+#include <vector>
+
+
+namespace rtc::coro::mpp_mcpp::v4d {
+    // Work-stealing executor
+    // Thread pool with one deque per thread
+    //
+    // Notes on implementation:
+    //
+    //   - schedule called from one of the worker threads pushes onto that worker's deque;
+    //     schedule called from any other thread pushes onto a shared injection queue
+    //   - A worker pops from the back of its own deque (LIFO, the most recently scheduled task is the hottest in cache),
+    //     then from the front of the injection queue, and then steals from the front of its peers' deques (FIFO)
+    //   - Every deque has its own mutex, so workers only contend when stealing
+    //   - Threads are pinned to cores, if any are given
+    //   - Only normal priority work goes to the per-thread deques; high and low priority work goes to shared lanes,
+    //     the high priority one being checked before anything else, and the low priority one after stealing
+    //   - A worker that finds no work first spins (see adaptive_spin) until the epoch changes, and then parks
+    //   - Parking protocol: a worker that finds no work registers itself as a sleeper, takes a snapshot of the epoch,
+    //     scans all the queues once more, and then waits until the epoch changes;
+    //     schedule bumps the epoch after every push, and only notifies if there are sleepers
+    //   - schedule_bulk takes every queue's lock once, and wakes at most as many sleepers as there are items
+    //   - schedule_next from a worker keeps the item in the worker's next slot, see next_slot
+    //   - Keeps executor metrics; steals are the items taken from a peer's deque, and the queue depth is the sum
+    //     of the sizes of all the queues
+    //
+    class work_stealing_executor final : public executor_interface {
+    public:
+        work_stealing_executor(size_t number_of_threads, std::vector<size_t> cores = {})
+            : cores_{ std::move(cores) } {
+            metrics_ = &own_metrics_;
+            for (size_t i{ 0 }; i < number_of_threads; ++i) {
+                workers_.push_back(std::make_unique<worker>());
+            }
+            for (size_t i{ 0 }; i < number_of_threads; ++i) {
+                threads_.emplace_back(std::bind_front(&work_stealing_executor::run_thread, this), i);
+            }
+        }
+        ~work_stealing_executor() {
+            debug_print("work_stealing_executor", "~work_stealing_executor");
+            std::ranges::for_each(threads_, [](std::jthread& t) { t.request_stop(); });
+            std::ranges::for_each(threads_, [](std::jthread& t) { t.join(); });
+        }
+        void schedule(work_item item) override {
+            own_metrics_.scheduled(item);
+            enqueue(std::move(item));
+        }
+        void schedule_bulk(std::span<work_item> items) override {
+            if (items.empty()) {
+                return;
+            }
+            own_metrics_.scheduled(items);
+            for (auto p : { priority::high, priority::normal, priority::low }) {
+                auto& queue{ queue_for(p) };
+                std::unique_lock<std::mutex> lock{ queue.mutex_, std::defer_lock };
+                for (auto& item : items) {
+                    if (item.get_priority() == p) {
+                        if (not lock.owns_lock()) {
+                            lock.lock();
+                        }
+                        queue.push_back(std::move(item));
+                    }
+                }
+            }
+            wake(items.size());
+        }
+        void schedule_next(work_item item) override {
+            if (current_executor_ == this && next_slot_.accepts(item)) {
+                own_metrics_.scheduled(item);
+                next_slot_.put(std::move(item));
+            } else {
+                schedule(std::move(item));
+            }
+        }
+        executor_metrics_snapshot get_metrics_snapshot() const override {
+            auto depth{ injection_.size_.load(std::memory_order_relaxed) +
+                high_priority_.size_.load(std::memory_order_relaxed) +
+                low_priority_.size_.load(std::memory_order_relaxed) };
+            for (const auto& w : workers_) {
+                depth += w->size_.load(std::memory_order_relaxed);
+            }
+            return own_metrics_.snapshot(depth);
+        }
+    private:
+        struct alignas(cache_line_size) worker {
+            // Under the mutex
+            void push_back(work_item item) {
+                deque_.push_back(std::move(item));
+                size_.store(deque_.size(), std::memory_order_relaxed);
+            }
+            work_item pop_front() {
+                auto item{ deque_.pop_front() };
+                size_.store(deque_.size(), std::memory_order_relaxed);
+                return item;
+            }
+            work_item pop_back() {
+                auto item{ deque_.pop_back() };
+                size_.store(deque_.size(), std::memory_order_relaxed);
+                return item;
+            }
+
+            std::mutex mutex_;
+            work_queue<work_item> deque_;
+            std::atomic<size_t> size_{};  // written under the mutex, read without it
+        };
+
+        static std::optional<work_item> pop_back(worker& w) {
+            std::lock_guard lock{ w.mutex_ };
+            if (w.deque_.empty()) {
+                return std::nullopt;
+            }
+            return w.pop_back();
+        }
+        static std::optional<work_item> pop_front(worker& w) {
+            std::lock_guard lock{ w.mutex_ };
+            if (w.deque_.empty()) {
+                return std::nullopt;
+            }
+            return w.pop_front();
+        }
+        // schedule without the metrics
+        void enqueue(work_item item) {
+            auto& queue{ queue_for(item.get_priority()) };
+            {
+                std::lock_guard lock{ queue.mutex_ };
+                queue.push_back(std::move(item));
+            }
+            wake(1);
+        }
+        worker& queue_for(priority p) noexcept {
+            switch (p) {
+                case priority::high: return high_priority_;
+                case priority::low: return low_priority_;
+                default: return (current_executor_ == this) ? *workers_[current_index_] : injection_;
+            }
+        }
+        std::optional<work_item> find_work(size_t index) {
+            if (auto ex{ pop_front(high_priority_) }) {
+                return ex;
+            }
+            if (auto ex{ pop_back(*workers_[index]) }) {
+                return ex;
+            }
+            if (auto ex{ pop_front(injection_) }) {
+                return ex;
+            }
+            // Start stealing from the next peer, so that thieves spread over the victims
+            for (size_t i{ 1 }; i < workers_.size(); ++i) {
+                if (auto ex{ pop_front(*workers_[(index + i) % workers_.size()]) }) {
+                    own_metrics_.stolen();
+                    return ex;
+                }
+            }
+            if (auto ex{ pop_front(low_priority_) }) {
+                return ex;
+            }
+            return std::nullopt;
+        }
+        void wake(size_t count) {
+            epoch_.fetch_add(1);
+            if (auto sleepers{ sleepers_.load() }; sleepers > 0) {
+                // Taking the lock guarantees the sleeper is either before its predicate check or already waiting
+                { std::lock_guard lock{ park_mutex_ }; }
+                if (count >= sleepers) {
+                    park_cva_.notify_all();
+                } else {
+                    for (size_t i{ 0 }; i < count; ++i) {
+                        park_cva_.notify_one();
+                    }
+                }
+            }
+        }
+        void park(std::stop_token stoken, size_t index, std::optional<work_item>& next) {
+            sleepers_.fetch_add(1);
+            auto epoch{ epoch_.load() };
+            if (next = find_work(index); not next) {
+                std::unique_lock<std::mutex> lock{ park_mutex_ };
+                park_cva_.wait(lock, stoken, [this, epoch]() {
+                    return epoch_.load() != epoch;
+                });
+            }
+            sleepers_.fetch_sub(1);
+        }
+        void run_thread(std::stop_token stoken, size_t index) {
+            pin_current_thread(cores_);
+            current_executor_ = this;
+            current_index_ = index;
+            own_metrics_.attach_thread();
+            adaptive_spin spinner{};
+            while (not stoken.stop_requested()) {
+                auto next{ find_work(index) };
+                if (not next) {
+                    auto epoch{ epoch_.load(std::memory_order_relaxed) };
+                    if (spinner.spin([this, epoch, &stoken]() {
+                            return epoch_.load(std::memory_order_relaxed) != epoch || stoken.stop_requested();
+                        })) {
+                        continue;
+                    }
+                    park(stoken, index, next);
+                }
+                if (next) {
+                    own_metrics_.execute(*next);
+                    next_slot_.run(own_metrics_,
+                        [this](priority p) {
+                            return p != priority::high && high_priority_.size_.load(std::memory_order_relaxed) != 0;
+                        },
+                        [this](work_item item) { enqueue(std::move(item)); });
+                }
+            }
+            current_executor_ = nullptr;
+            debug_print("work_stealing_executor", "exiting run_thread");
+        }
+
+        static inline thread_local work_stealing_executor* current_executor_{};
+        static inline thread_local size_t current_index_{};
+        static inline thread_local next_slot next_slot_{};
+
+        std::vector<size_t> cores_;
+        executor_metrics own_metrics_;
+        std::vector<std::unique_ptr<worker>> workers_;
+        worker injection_;
+        worker high_priority_;
+        worker low_priority_;
+        alignas(cache_line_size) std::atomic<std::uint64_t> epoch_{};
+        std::atomic<size_t> sleepers_{};
+        std::mutex park_mutex_;
+        std::condition_variable_any park_cva_;
+        std::vector<std::jthread> threads_;
+    };
+
+
+    template <size_t concurrency_level = DEFAULT_CONCURRENCY>
+    using work_stealing_executor_provider = executor_provider<concurrency_level, work_stealing_executor>;
+}  // namespace rtc::coro::mpp_mcpp::v4d
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>  // sort
+#include <charconv>  // from_chars
+#include <cstddef>  // size_t
+#include <filesystem>  // directory_iterator, path
+#include <fstream>  // ifstream
+#include <optional>
+#include <span>
+#include <string>  // getline
+#include <string_view>
+#include <system_error>  // errc, error_code
+#include <thread>  // hardware_concurrency
+#include <utility>  // pair
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>  // pthread_setaffinity_np
+#include <sched.h>  // CPU_COUNT, CPU_SET, CPU_SETSIZE, CPU_ZERO, sched_getcpu
+#elif defined(_WIN32)
+#include <windows.h>  // GetCurrentProcessorNumber, GetNumaHighestNodeNumber, GetNumaNodeProcessorMask, SetThreadAffinityMask
+#endif
+
+
+// Thread affinity
+//
+// Helpers to pin threads to cores, and to find out which cores belong to which NUMA node
+//
+// E.g.
+//   for (auto& cores : numa_nodes()) {
+//       threads.emplace_back([cores]() { pin_current_thread(cores); ... });
+//   }
+//
+// Notes on implementation:
+//
+//   - Everything is best effort: a thread that can't be pinned just runs unpinned,
+//     and a system whose topology can't be read is one node with every core
+//   - A core the platform can't put in an affinity mask (CPU_SETSIZE and up on Linux, 64 and up in a Windows mask)
+//     is skipped, and a thread with none left is not pinned
+//   - On Linux, NUMA nodes are read from /sys/devices/system/node, so no libnuma is needed
+
+
+namespace rtc::coro {
+    inline std::size_t number_of_cores() noexcept {
+        auto n{ std::thread::hardware_concurrency() };
+        return n == 0 ? 1 : n;
+    }
+
+    // Pins the calling thread to a set of cores; the thread can still move between them
+    inline void pin_current_thread(std::span<const std::size_t> cores) noexcept {
+#if defined(__linux__)
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (auto core : cores) {
+            if (core < CPU_SETSIZE) {
+                CPU_SET(core, &cpu_set);
+            }
+        }
+        if (CPU_COUNT(&cpu_set) > 0) {
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        }
+#elif defined(_WIN32)
+        constexpr std::size_t mask_bits{ 8 * sizeof(DWORD_PTR) };
+        DWORD_PTR mask{};
+        for (auto core : cores) {
+            if (core < mask_bits) {
+                mask |= DWORD_PTR{ 1 } << core;
+            }
+        }
+        if (mask != 0) {
+            SetThreadAffinityMask(GetCurrentThread(), mask);
+        }
+#endif
+    }
+
+    // The core the calling thread is running on, if known
+    inline std::optional<std::size_t> current_core() noexcept {
+#if defined(__linux__)
+        if (auto core{ sched_getcpu() }; core >= 0) {
+            return static_cast<std::size_t>(core);
+        }
+#elif defined(_WIN32)
+        return static_cast<std::size_t>(GetCurrentProcessorNumber());
+#endif
+        return std::nullopt;
+    }
+
+    // Parses a Linux cpu list, e.g. "0-3,8,10-11"
+    inline std::vector<std::size_t> parse_cpu_list(std::string_view list) {
+        std::vector<std::size_t> cores;
+        while (not list.empty()) {
+            auto comma{ list.find(',') };
+            auto item{ list.substr(0, comma) };
+            list = (comma == std::string_view::npos) ? std::string_view{} : list.substr(comma + 1);
+            auto dash{ item.find('-') };
+            std::size_t first{};
+            if (std::from_chars(item.data(), item.data() + item.size(), first).ec != std::errc{}) {
+                continue;
+            }
+            auto last{ first };
+            if (dash != std::string_view::npos) {
+                auto to{ item.substr(dash + 1) };
+                std::from_chars(to.data(), to.data() + to.size(), last);
+            }
+            for (auto core{ first }; core <= last; ++core) {
+                cores.push_back(core);
+            }
+        }
+        return cores;
+    }
+
+    // Cores of every NUMA node, by node number
+    inline std::vector<std::vector<std::size_t>> numa_nodes() {
+        std::vector<std::vector<std::size_t>> nodes;
+#if defined(__linux__)
+        std::vector<std::pair<std::size_t, std::vector<std::size_t>>> found;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator{ "/sys/devices/system/node", ec }) {
+            auto name{ entry.path().filename().string() };
+            std::size_t node{};
+            if (not name.starts_with("node") ||
+                std::from_chars(name.data() + 4, name.data() + name.size(), node).ec != std::errc{}) {
+                continue;
+            }
+            std::ifstream file{ entry.path() / "cpulist" };
+            std::string list;
+            if (std::getline(file, list)) {
+                if (auto cores{ parse_cpu_list(list) }; not cores.empty()) {
+                    found.emplace_back(node, std::move(cores));
+                }
+            }
+        }
+        std::ranges::sort(found, {}, &std::pair<std::size_t, std::vector<std::size_t>>::first);
+        for (auto& [node, cores] : found) {
+            nodes.push_back(std::move(cores));
+        }
+#elif defined(_WIN32)
+        ULONG highest{};
+        if (GetNumaHighestNodeNumber(&highest)) {
+            for (ULONG node{ 0 }; node <= highest; ++node) {
+                ULONGLONG mask{};
+                if (not GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask) || mask == 0) {
+                    continue;
+                }
+                std::vector<std::size_t> cores;
+                for (std::size_t core{ 0 }; core < 64; ++core) {
+                    if (mask & (ULONGLONG{ 1 } << core)) {
+                        cores.push_back(core);
+                    }
+                }
+                nodes.push_back(std::move(cores));
+            }
+        }
+#endif
+        if (nodes.empty()) {
+            std::vector<std::size_t> cores(number_of_cores());
+            for (std::size_t core{ 0 }; core < cores.size(); ++core) {
+                cores[core] = core;
+            }
+            nodes.push_back(std::move(cores));
+        }
+        return nodes;
+    }
+}  // namespace rtc::coro
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "frame_pool.h"
+
+#include <coroutine>
+#include <cstddef>  // size_t
+#include <exception>  // current_exception, exception_ptr, rethrow_exception
+#include <optional>
+#include <type_traits>  // conditional_t, is_void_v
+#include <utility>  // exchange, move
+#include <variant>  // monostate
+
+#include <asio.hpp>
+
+
+// Async generator
+//
+// A std::generator can only yield; if producing the next value needs I/O, the producer has to block,
+// and with it, the whole io_context
+// An async_generator can both co_yield values and co_await asio awaitables, and it is consumed from an asio::awaitable:
+//
+//   async_generator<record> records(asio::ip::tcp::socket& socket) {
+//       for (;;) {
+//           auto n{ co_await socket.async_read_some(buffer, asio::use_awaitable) };
+//           for (auto& r : parse(buffer, n)) {
+//               co_yield r;
+//           }
+//       }
+//   }
+//
+//   asio::awaitable<void> consume(asio::ip::tcp::socket& socket) {
+//       auto gen{ records(socket) };
+//       while (auto r{ co_await gen.next() }) {
+//           process(*r);
+//       }
+//   }
+//
+// Notes on implementation:
+//
+//   - The generator is lazy, and it only runs inside next(), on the consumer's thread of execution
+//   - asio awaitables can only be co_awaited from another asio awaitable, so the generator doesn't await them itself:
+//     co_await just parks the operation in the promise and suspends; next() then co_awaits it on the generator's behalf,
+//     stores the result in the generator's awaiter, and resumes the generator
+//   - asio::this_coro::executor gives the consumer's executor
+//   - Frames are recycled through the frame pool
+
+
+namespace rtc::coro {
+    template <typename T>
+    class async_generator {
+    public:
+        class promise_type {
+        public:
+            static void* operator new(std::size_t size) {
+                return frame_pool::allocate(size);
+            }
+            static void operator delete(void* ptr, std::size_t size) noexcept {
+                frame_pool::deallocate(ptr, size);
+            }
+            async_generator get_return_object() noexcept {
+                return async_generator{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_always final_suspend() noexcept {
+                return {};
+            }
+            std::suspend_always yield_value(T value) {
+                value_.emplace(std::move(value));
+                return {};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {
+                exception_ = std::current_exception();
+            }
+
+            template <typename U>
+            auto await_transform(asio::awaitable<U> awaitable) {
+                return operation_awaiter<U>{ *this, std::move(awaitable) };
+            }
+            auto await_transform(asio::this_coro::executor_t) noexcept {
+                struct executor_awaiter : std::suspend_never {
+                    asio::any_io_executor executor_;
+
+                    asio::any_io_executor await_resume() const noexcept {
+                        return executor_;
+                    }
+                };
+                return executor_awaiter{ {}, executor_ };
+            }
+        private:
+            friend async_generator;
+
+            // Suspends the generator until next() has run the operation
+            template <typename U>
+            class operation_awaiter {
+            public:
+                operation_awaiter(promise_type& promise, asio::awaitable<U> awaitable)
+                    : promise_{ promise }
+                    , awaitable_{ std::move(awaitable) }
+                {}
+                bool await_ready() const noexcept {
+                    return false;
+                }
+                void await_suspend(std::coroutine_handle<>) {
+                    promise_.pending_operation_.emplace(run(*this));
+                }
+                U await_resume() {
+                    if (exception_) {
+                        std::rethrow_exception(exception_);
+                    }
+                    if constexpr (not std::is_void_v<U>) {
+                        return std::move(*result_);
+                    }
+                }
+            private:
+                using result_type = std::conditional_t<std::is_void_v<U>, std::monostate, U>;
+
+                static asio::awaitable<void> run(operation_awaiter& self) {
+                    try {
+                        if constexpr (std::is_void_v<U>) {
+                            co_await std::move(self.awaitable_);
+                            self.result_.emplace();
+                        } else {
+                            self.result_.emplace(co_await std::move(self.awaitable_));
+                        }
+                    } catch (...) {
+                        self.exception_ = std::current_exception();
+                    }
+                }
+
+                promise_type& promise_;
+                asio::awaitable<U> awaitable_;
+                std::optional<result_type> result_;
+                std::exception_ptr exception_;
+            };
+
+            std::optional<T> value_;
+            std::exception_ptr exception_;
+            std::optional<asio::awaitable<void>> pending_operation_;
+            asio::any_io_executor executor_;
+        };
+
+        async_generator(async_generator&& other) noexcept
+            : handle_{ std::exchange(other.handle_, nullptr) }
+        {}
+        async_generator& operator=(async_generator&& other) noexcept {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+        ~async_generator() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        // Runs the generator until it yields a value, or finishes, in which case it returns an empty optional
+        // Rethrows whatever exception the generator exits with
+        asio::awaitable<std::optional<T>> next() {
+            if (not handle_ || handle_.done()) {
+                co_return std::nullopt;
+            }
+            auto& promise{ handle_.promise() };
+            promise.executor_ = co_await asio::this_coro::executor;
+            promise.value_.reset();
+            for (;;) {
+                handle_.resume();
+                if (not promise.pending_operation_) {
+                    break;
+                }
+                auto operation{ std::move(*promise.pending_operation_) };
+                promise.pending_operation_.reset();
+                co_await std::move(operation);
+            }
+            if (promise.exception_) {
+                std::rethrow_exception(std::exchange(promise.exception_, nullptr));
+            }
+            co_return std::exchange(promise.value_, std::nullopt);
+        }
+    private:
+        explicit async_generator(std::coroutine_handle<promise_type> handle) noexcept
+            : handle_{ handle }
+        {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+}  // namespace rtc::coro
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <bit>  // bit_width
+#include <cstddef>  // byte, size_t
+#include <mutex>  // lock_guard
+#include <new>  // operator delete, operator new
+#include <utility>  // exchange
+
+#include <asio.hpp>
+
+
+// Buffer pool
+//
+// Sessions borrow their I/O buffers from a shared pool, and give them back when they are done,
+// so that, once the pool is warm, reading and writing never go to the global allocator
+// Reads land directly in the pooled memory, which the consumer then processes in place
+//
+// E.g.
+//   auto buffer{ buffer_pool::shared().acquire(64 * 1024) };
+//   auto n{ co_await socket.async_read_some(buffer.mutable_buffer(), asio::use_awaitable) };
+//   process(buffer.data(), n);
+//
+// Notes on implementation:
+//
+//   - Buffer sizes are rounded up to a power of two, from min_buffer_size to max_buffer_size;
+//     bigger buffers than max_buffer_size are not pooled
+//   - One free list per size class, each one behind its own mutex, which is only held for a pointer swap
+//   - Free lists are capped, so that a burst of sessions doesn't keep its memory forever
+
+
+namespace rtc::coro {
+    class buffer_pool;
+
+
+    // Pooled buffer
+    // Owns a buffer borrowed from a pool, and gives it back when destroyed
+    class pooled_buffer {
+    public:
+        pooled_buffer() = default;
+        pooled_buffer(pooled_buffer&& other) noexcept
+            : pool_{ std::exchange(other.pool_, nullptr) }
+            , data_{ std::exchange(other.data_, nullptr) }
+            , capacity_{ std::exchange(other.capacity_, 0) }
+        {}
+        pooled_buffer& operator=(pooled_buffer&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool_ = std::exchange(other.pool_, nullptr);
+                data_ = std::exchange(other.data_, nullptr);
+                capacity_ = std::exchange(other.capacity_, 0);
+            }
+            return *this;
+        }
+        ~pooled_buffer() {
+            release();
+        }
+
+        std::byte* data() const noexcept {
+            return data_;
+        }
+        std::size_t capacity() const noexcept {
+            return capacity_;
+        }
+        // asio buffers over the whole buffer, or over a part of it
+        asio::mutable_buffer mutable_buffer(std::size_t offset = 0) const noexcept {
+            return asio::buffer(data_ + offset, capacity_ - offset);
+        }
+        asio::const_buffer const_buffer(std::size_t size) const noexcept {
+            return asio::buffer(data_, size);
+        }
+    private:
+        friend buffer_pool;
+
+        pooled_buffer(buffer_pool* pool, std::byte* data, std::size_t capacity) noexcept
+            : pool_{ pool }
+            , data_{ data }
+            , capacity_{ capacity }
+        {}
+        inline void release() noexcept;
+
+        buffer_pool* pool_{};
+        std::byte* data_{};
+        std::size_t capacity_{};
+    };
+
+
+    class buffer_pool {
+    public:
+        static constexpr std::size_t min_buffer_size = 512;
+        static constexpr std::size_t max_buffer_size = 64 * 1024;
+        static constexpr std::size_t max_free_buffers_per_size_class = 64;
+
+        // Pool shared by all the sessions
+        static buffer_pool& shared() {
+            static buffer_pool instance{};
+            return instance;
+        }
+
+        buffer_pool() = default;
+        buffer_pool(const buffer_pool&) = delete;
+        buffer_pool& operator=(const buffer_pool&) = delete;
+        ~buffer_pool() {
+            for (std::size_t index{ 0 }; index < size_classes_.size(); ++index) {
+                while (auto block{ size_classes_[index].head_ }) {
+                    size_classes_[index].head_ = block->next_;
+                    ::operator delete(block, size_class_size(index));
+                }
+            }
+        }
+
+        // The buffer's capacity is at least size
+        pooled_buffer acquire(std::size_t size) {
+            if (size > max_buffer_size) {
+                return pooled_buffer{ this, static_cast<std::byte*>(::operator new(size)), size };
+            }
+            auto index{ size_class_index(size) };
+            auto capacity{ size_class_size(index) };
+            auto& size_class{ size_classes_[index] };
+            {
+                std::lock_guard lock{ size_class.mutex_ };
+                if (auto block{ size_class.head_ }) {
+                    size_class.head_ = block->next_;
+                    --size_class.size_;
+                    return pooled_buffer{ this, reinterpret_cast<std::byte*>(block), capacity };
+                }
+            }
+            return pooled_buffer{ this, static_cast<std::byte*>(::operator new(capacity)), capacity };
+        }
+    private:
+        friend pooled_buffer;
+
+        static constexpr std::size_t number_of_size_classes =
+            std::bit_width(max_buffer_size / min_buffer_size);
+
+        struct free_block {
+            free_block* next_;
+        };
+
+        struct size_class {
+            std::mutex mutex_;
+            free_block* head_{};
+            std::size_t size_{};
+        };
+
+        static constexpr std::size_t size_class_index(std::size_t size) noexcept {
+            return size <= min_buffer_size ? 0 : std::bit_width((size - 1) / min_buffer_size);
+        }
+        static constexpr std::size_t size_class_size(std::size_t index) noexcept {
+            return min_buffer_size << index;
+        }
+
+        // capacity is always either a size class size, or bigger than max_buffer_size
+        void release(std::byte* data, std::size_t capacity) noexcept {
+            if (capacity <= max_buffer_size) {
+                auto& size_class{ size_classes_[size_class_index(capacity)] };
+                std::lock_guard lock{ size_class.mutex_ };
+                if (size_class.size_ < max_free_buffers_per_size_class) {
+                    size_class.head_ = ::new (data) free_block{ size_class.head_ };
+                    ++size_class.size_;
+                    return;
+                }
+            }
+            ::operator delete(data, capacity);
+        }
+
+        std::array<size_class, number_of_size_classes> size_classes_{};
+    };
+
+
+    inline void pooled_buffer::release() noexcept {
+        if (pool_) {
+            pool_->release(std::exchange(data_, nullptr), std::exchange(capacity_, 0));
+            pool_ = nullptr;
+        }
+    }
+}  // namespace rtc::coro
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "frame_pool.h"
+
+#include <coroutine>
+#include <cstddef>  // ptrdiff_t, size_t
+#include <exception>  // current_exception, exception_ptr, rethrow_exception
+#include <iterator>  // default_sentinel_t, input_iterator_tag
+#include <ranges>  // view_interface
+#include <span>
+#include <utility>  // exchange
+
+
+// Chunked generator
+//
+// Iterating a std::generator costs one resume per element, which dominates when elements are small, e.g. ints
+// A chunked_generator yields spans of elements instead, typically of a buffer the producer fills before every co_yield,
+// and it is only resumed once per span:
+//
+//   chunked_generator<int> sequence() {
+//       std::array<int, 256> buffer{};
+//       for (int i{ 0 };; ) {
+//           for (auto& e : buffer) { e = i++; }
+//           co_yield std::span<const int>{ buffer };
+//       }
+//   }
+//
+// It can be consumed element by element, with the iterator walking every span locally,
+//
+//   for (int i : sequence()) { ... }
+//
+// or span by span, e.g. to run a vectorized loop over every span:
+//
+//   for (std::span<const int> chunk : gen.chunks()) { ... }
+//
+// Notes on implementation:
+//
+//   - A span only has to stay valid until the generator is resumed, so the producer can refill the same buffer
+//   - A single element can be yielded too, as a span of one
+//   - Empty spans are skipped
+//   - Frames are recycled through the frame pool
+
+
+namespace rtc::coro {
+    template <typename T>
+    class chunked_generator : public std::ranges::view_interface<chunked_generator<T>> {
+    public:
+        class promise_type {
+        public:
+            static void* operator new(std::size_t size) {
+                return frame_pool::allocate(size);
+            }
+            static void operator delete(void* ptr, std::size_t size) noexcept {
+                frame_pool::deallocate(ptr, size);
+            }
+            chunked_generator get_return_object() noexcept {
+                return chunked_generator{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_always final_suspend() noexcept {
+                return {};
+            }
+            std::suspend_always yield_value(std::span<const T> chunk) noexcept {
+                chunk_ = chunk;
+                return {};
+            }
+            // The element lives in the coroutine frame until the generator is resumed
+            std::suspend_always yield_value(const T& element) noexcept {
+                chunk_ = std::span<const T>{ &element, 1 };
+                return {};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {
+                exception_ = std::current_exception();
+            }
+            // Chunked generators can't co_await
+            template <typename U>
+            void await_transform(U&&) = delete;
+        private:
+            friend chunked_generator;
+
+            std::span<const T> chunk_;
+            std::exception_ptr exception_;
+        };
+
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        // Iterates span by span
+        class chunk_iterator {
+        public:
+            using iterator_concept = std::input_iterator_tag;
+            using value_type = std::span<const T>;
+            using difference_type = std::ptrdiff_t;
+
+            chunk_iterator() = default;
+            explicit chunk_iterator(handle_type handle) noexcept
+                : handle_{ handle }
+            {}
+            chunk_iterator(chunk_iterator&& other) noexcept
+                : handle_{ std::exchange(other.handle_, nullptr) }
+            {}
+            chunk_iterator& operator=(chunk_iterator&& other) noexcept {
+                handle_ = std::exchange(other.handle_, nullptr);
+                return *this;
+            }
+            std::span<const T> operator*() const noexcept {
+                return handle_.promise().chunk_;
+            }
+            chunk_iterator& operator++() {
+                advance(handle_);
+                return *this;
+            }
+            void operator++(int) {
+                ++*this;
+            }
+            friend bool operator==(const chunk_iterator& it, std::default_sentinel_t) noexcept {
+                return it.handle_.done();
+            }
+        private:
+            handle_type handle_;
+        };
+
+        // Iterates element by element, and only resumes the generator once the current span is exhausted
+        class iterator {
+        public:
+            using iterator_concept = std::input_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(handle_type handle) noexcept
+                : handle_{ handle } {
+                load();
+            }
+            iterator(iterator&& other) noexcept
+                : handle_{ std::exchange(other.handle_, nullptr) }
+                , current_{ std::exchange(other.current_, nullptr) }
+                , end_{ std::exchange(other.end_, nullptr) }
+            {}
+            iterator& operator=(iterator&& other) noexcept {
+                handle_ = std::exchange(other.handle_, nullptr);
+                current_ = std::exchange(other.current_, nullptr);
+                end_ = std::exchange(other.end_, nullptr);
+                return *this;
+            }
+            const T& operator*() const noexcept {
+                return *current_;
+            }
+            iterator& operator++() {
+                if (++current_ == end_) {
+                    advance(handle_);
+                    load();
+                }
+                return *this;
+            }
+            void operator++(int) {
+                ++*this;
+            }
+            friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept {
+                return it.current_ == it.end_;
+            }
+        private:
+            void load() noexcept {
+                auto chunk{ handle_.promise().chunk_ };
+                current_ = chunk.data();
+                end_ = chunk.data() + chunk.size();
+            }
+
+            handle_type handle_;
+            const T* current_{};
+            const T* end_{};
+        };
+
+        // Span by span view over the generator
+        class chunk_view : public std::ranges::view_interface<chunk_view> {
+        public:
+            explicit chunk_view(chunked_generator& generator) noexcept
+                : generator_{ &generator }
+            {}
+            chunk_iterator begin() {
+                return chunk_iterator{ generator_->start() };
+            }
+            std::default_sentinel_t end() const noexcept {
+                return {};
+            }
+        private:
+            chunked_generator* generator_;
+        };
+
+        chunked_generator(chunked_generator&& other) noexcept
+            : handle_{ std::exchange(other.handle_, nullptr) }
+        {}
+        chunked_generator& operator=(chunked_generator&& other) noexcept {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+        ~chunked_generator() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        // A generator can only be iterated once, either by elements or by chunks
+        iterator begin() {
+            return iterator{ start() };
+        }
+        std::default_sentinel_t end() const noexcept {
+            return {};
+        }
+        chunk_view chunks() noexcept {
+            return chunk_view{ *this };
+        }
+    private:
+        explicit chunked_generator(handle_type handle) noexcept
+            : handle_{ handle }
+        {}
+        handle_type start() {
+            advance(handle_);
+            return handle_;
+        }
+        // Resumes the generator until it yields a non-empty span, or finishes
+        static void advance(handle_type handle) {
+            auto& promise{ handle.promise() };
+            do {
+                promise.chunk_ = {};
+                handle.resume();
+                if (promise.exception_) {
+                    std::rethrow_exception(std::exchange(promise.exception_, nullptr));
+                }
+            } while (promise.chunk_.empty() && not handle.done());
+        }
+
+        handle_type handle_;
+    };
+}  // namespace rtc::coro
@@ -1,54 +1,306 @@
 #pragma once
 
+#include "buffer_pool.h"
 #include "coro_sequence.h"
+#include "framing.h"
+#include "io_context_pool.h"
+#include "MPP_MCpp/v4d/asio_bridge.h"
+#include "MPP_MCpp/v4d/ctask.h"
+#include "token_bucket.h"
 
+#include <algorithm>  // max
 #include <asio.hpp>
 #include <chrono>
+#include <cstddef>  // byte, size_t
+#include <cstdint>  // uint32_t
+#include <cstring>  // memcpy, memmove
 #include <exception>
 #include <fmt/core.h>
-#include <thread>  // sleep_for
+#include <functional>  // function
+#include <future>
+#include <memory>  // make_shared, shared_ptr
+#include <stdexcept>  // runtime_error
+#include <unordered_map>
+#include <utility>  // move
+#include <vector>
 
 
 namespace rtc::coro::client_server_asio {
     constinit const int port{ 1234 };
 
-    inline asio::awaitable<void> serve(asio::ip::tcp::socket socket) {
-        std::string data{};
+    // Streams end with the first value greater than 3
+    inline bool is_last(int n) noexcept {
+        return n > 3;
+    }
+
+    // Per-connection pacing
+    // serve waits on a steady_timer instead of sleeping, so the io_context goes on running the other connections
+    struct pacing {
+        double messages_per_second{ 1.0 };
+        double burst_size{ 1.0 };
+    };
+
+    // Waits until the bucket has tokens for the next messages
+    inline asio::awaitable<void> pace(token_bucket& bucket, asio::steady_timer& timer, std::size_t messages = 1) {
+        if (auto delay{ bucket.take(static_cast<double>(messages)) }; delay > token_bucket::duration::zero()) {
+            timer.expires_after(delay);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+    }
+
+    inline asio::awaitable<void> serve(asio::ip::tcp::socket socket, pacing pacing = {}) {
+        token_bucket bucket{ pacing.messages_per_second, pacing.burst_size };
+        asio::steady_timer timer{ socket.get_executor() };
         for (auto&& n : coro_sequence()) {
             int data[]{ n };
 
+            co_await pace(bucket, timer);
             co_await asio::async_write(socket, asio::buffer(data), asio::use_awaitable);
             fmt::print("[serve] Written {} bytes: {}\n", sizeof(data), data[0]);
 
-            using namespace std::chrono_literals;
-            std::this_thread::sleep_for(1s);
-
-            if (n > 3) {
+            if (is_last(n)) {
                 co_return;
             }
         }
     }
 
-    inline asio::awaitable<void> server(asio::io_context& io_ctx) {
+    // Batched framing
+    // Up to batch_size values are drained from the generator into a buffer borrowed from the buffer pool,
+    // and written at once, so a stream costs one write per batch instead of one write per value
+    inline asio::awaitable<void> serve_batched(asio::ip::tcp::socket socket, std::size_t batch_size, pacing pacing = {}) {
+        token_bucket bucket{ pacing.messages_per_second, pacing.burst_size };
+        asio::steady_timer timer{ socket.get_executor() };
+        auto buffer{ buffer_pool::shared().acquire(batch_size * sizeof(int)) };
+        auto sequence{ coro_sequence() };
+        auto it{ sequence.begin() };
+        for (bool last{ false }; not last; ) {
+            std::size_t count{ 0 };
+            int first{ *it };
+            int value{};
+            while (count < batch_size && not last) {
+                value = *it;
+                std::memcpy(buffer.data() + count * sizeof(int), &value, sizeof(int));
+                ++count;
+                if (not (last = is_last(value))) {
+                    ++it;
+                }
+            }
+
+            co_await pace(bucket, timer, count);
+            co_await asio::async_write(socket, buffer.const_buffer(count * sizeof(int)), asio::use_awaitable);
+            fmt::print("[serve] Written {} bytes: {} values, from {} to {}\n", count * sizeof(int), count, first, value);
+        }
+    }
+
+    // Pipelined request/response
+    // Requests and responses are frames (see framing.h), and a connection can have many requests in flight
+    // Every request is handled by its own coroutine, which computes the response on the ctask executor, and writes it
+    // as soon as it's ready, so a slow request doesn't hold back the ones read after it
+    // Once max_in_flight requests of a connection are being handled, its reader stops reading until one completes,
+    // so a client that sends faster than it's served fills its TCP window instead of the server's memory
+    //
+    // A request handler returns the payload of the response to a request
+    using request_handler = std::function<mpp_mcpp::v4d::ctask<std::vector<std::byte>>(framing::frame)>;
+
+    // Returns the request's payload
+    inline mpp_mcpp::v4d::ctask<std::vector<std::byte>> echo(framing::frame request) {
+        co_return std::move(request.payload);
+    }
+
+    constexpr std::size_t default_max_requests_in_flight{ 64 };
+
+    // Shared by the connection's reader and its request handlers, so it lives until the last response is written
+    // Only used from the io_context's thread, as the frame reader and writer are
+    struct pipelined_session {
+        pipelined_session(asio::ip::tcp::socket s, request_handler h)
+            : socket{ std::move(s) }
+            , handler{ std::move(h) }
+            , window_timer{ socket.get_executor() }
+        {}
+
+        asio::ip::tcp::socket socket;
+        request_handler handler;
+        framing::frame_writer<asio::ip::tcp::socket> writer{ socket };
+        asio::steady_timer window_timer;  // cancelled whenever a request completes, to wake up a paused reader
+        std::size_t in_flight{ 0 };
+    };
+
+    // A failed request closes the connection, since the protocol has no error responses
+    inline asio::awaitable<void> handle_request(std::shared_ptr<pipelined_session> session, framing::frame request) {
+        auto id{ request.id };
+        try {
+            // as_awaitable resumes this coroutine back on the session's io_context
+            auto response{ co_await mpp_mcpp::v4d::as_awaitable(session->handler(std::move(request))) };
+            co_await session->writer.write(id, response);
+        } catch (const std::exception& e) {
+            fmt::print("[serve] Request {} failed: {}\n", id, e.what());
+            asio::error_code ec{};
+            session->socket.close(ec);
+        }
+        --session->in_flight;
+        session->window_timer.cancel();
+    }
+
+    inline asio::awaitable<void> serve_pipelined(asio::ip::tcp::socket socket, request_handler handler = echo,
+        std::size_t max_in_flight = default_max_requests_in_flight) {
+        auto session{ std::make_shared<pipelined_session>(std::move(socket), std::move(handler)) };
+        framing::frame_reader reader{ session->socket };
+        max_in_flight = std::max(max_in_flight, std::size_t{ 1 });
+        std::size_t requests{ 0 };
+        for (;;) {
+            while (session->in_flight >= max_in_flight) {
+                asio::error_code ec{};
+                session->window_timer.expires_at(asio::steady_timer::time_point::max());
+                co_await session->window_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+            }
+            auto request{ co_await reader.read() };
+            if (not request) {
+                break;
+            }
+            ++session->in_flight;
+            co_spawn(session->socket.get_executor(), handle_request(session, std::move(*request)), asio::detached);
+            ++requests;
+        }
+        fmt::print("[serve] Read {} requests\n", requests);
+    }
+
+    struct serve_options {
+        pacing rate{};
+        std::size_t batch_size{ 1 };  // one value per write unless greater than 1
+        bool pipelined{ false };  // framed requests and responses, see serve_pipelined, instead of a stream of values
+        std::size_t max_requests_in_flight{ default_max_requests_in_flight };  // per pipelined connection
+        std::size_t max_connections{ 0 };  // server stops accepting after that many, unless 0
+    };
+
+    // Keeps the session counted as load of its home io_context, if any, while it runs
+    inline asio::awaitable<void> serve_session(asio::ip::tcp::socket socket, serve_options options, io_context_pool::load_token) {
+        if (options.pipelined) {
+            co_await serve_pipelined(std::move(socket), echo, options.max_requests_in_flight);
+        } else if (options.batch_size > 1) {
+            co_await serve_batched(std::move(socket), options.batch_size, options.rate);
+        } else {
+            co_await serve(std::move(socket), options.rate);
+        }
+    }
+
+    // A failed accept, e.g. once the process runs out of file descriptors, is retried after a pause, instead of ending
+    // the accept loop, so a burst of connections doesn't take the server down; only closing the acceptor ends it
+    // Returns whether the accept loop goes on
+    inline asio::awaitable<bool> recover_from_accept_error(const asio::error_code& ec, asio::steady_timer& timer) {
+        if (ec == asio::error::operation_aborted) {
+            co_return false;
+        }
+        fmt::print("[server] Failed to accept a connection: {}\n", ec.message());
+        timer.expires_after(std::chrono::milliseconds{ 10 });
+        co_await timer.async_wait(asio::use_awaitable);
+        co_return true;
+    }
+
+    // Accepts connections until the acceptor is closed, or options.max_connections have been accepted,
+    // and serves every one of them in its own coroutine; the sessions may outlive the server
+    inline asio::awaitable<void> server(asio::io_context& io_ctx, serve_options options = {}) {
         fmt::print("[server] Starting\n");
-        fmt::print("[server] Accepting a connection from a client...\n");
         asio::ip::tcp::acceptor acceptor{ io_ctx, { asio::ip::tcp::v4(), port } };
-        fmt::print("[server] Accepted a connection from a client\n");
-        fmt::print("[server] Spawning serve...\n");
-        co_spawn(
-            io_ctx,
-            serve(co_await acceptor.async_accept(asio::use_awaitable)),
-            asio::detached
-        );
+        asio::steady_timer retry_timer{ io_ctx };
+        for (std::size_t accepted{ 0 }; options.max_connections == 0 || accepted < options.max_connections; ) {
+            fmt::print("[server] Accepting a connection from a client...\n");
+            asio::error_code ec{};
+            auto socket{ co_await acceptor.async_accept(asio::redirect_error(asio::use_awaitable, ec)) };
+            if (ec) {
+                auto accepting{ co_await recover_from_accept_error(ec, retry_timer) };
+                if (not accepting) {
+                    co_return;
+                }
+                continue;
+            }
+            fmt::print("[server] Accepted a connection from a client\n");
+            co_spawn(io_ctx, serve_session(std::move(socket), options, {}), asio::detached);
+            ++accepted;
+        }
+        fmt::print("[server] Accepted {} connections, stopping\n", options.max_connections);
     }
 
-    inline asio::awaitable<void> client(asio::io_context& io_ctx) {
-        fmt::print("[client] Starting\n");
+    // Multi-threaded server
+    // Sessions are spread over an io_context pool, one io_context per core, and every session stays on its home io_context
+    //
+    //   - hand_off: a single acceptor hands every accepted socket over to the least loaded io_context
+    //   - reuse_port: every io_context has its own acceptor, all of them bound to the same port with SO_REUSEPORT,
+    //     and the kernel spreads the connections (not available on every platform, e.g. Windows)
+    enum class accept_mode { hand_off, reuse_port };
+
+    inline asio::awaitable<void> accept_hand_off(io_context_pool& pool, asio::ip::tcp::acceptor acceptor, serve_options options) {
+        asio::steady_timer retry_timer{ acceptor.get_executor() };
+        for (;;) {
+            // The socket is accepted directly on its home io_context
+            auto i{ pool.least_loaded_index() };
+            auto& home{ pool.get_io_context(i) };
+            asio::error_code ec{};
+            auto socket{ co_await acceptor.async_accept(home, asio::redirect_error(asio::use_awaitable, ec)) };
+            if (ec) {
+                auto accepting{ co_await recover_from_accept_error(ec, retry_timer) };
+                if (not accepting) {
+                    co_return;
+                }
+                continue;
+            }
+            co_spawn(home, serve_session(std::move(socket), options, pool.make_load_token(i)), asio::detached);
+        }
+    }
+
+    inline asio::awaitable<void> accept_reuse_port(io_context_pool& pool, std::size_t i, asio::ip::tcp::acceptor acceptor,
+        serve_options options) {
+        asio::steady_timer retry_timer{ acceptor.get_executor() };
+        for (;;) {
+            asio::error_code ec{};
+            auto socket{ co_await acceptor.async_accept(asio::redirect_error(asio::use_awaitable, ec)) };
+            if (ec) {
+                auto accepting{ co_await recover_from_accept_error(ec, retry_timer) };
+                if (not accepting) {
+                    co_return;
+                }
+                continue;
+            }
+            co_spawn(pool.get_io_context(i), serve_session(std::move(socket), options, pool.make_load_token(i)), asio::detached);
+        }
+    }
+
+    // The acceptors are created before returning, so clients can connect as soon as this function returns
+    inline void start_server(io_context_pool& pool, accept_mode mode, serve_options options = {}) {
+        fmt::print("[server] Starting on {} io_contexts\n", pool.size());
+        asio::ip::tcp::endpoint endpoint{ asio::ip::tcp::v4(), port };
+        if (mode == accept_mode::hand_off) {
+            auto& io_ctx{ pool.get_io_context(0) };
+            co_spawn(io_ctx, accept_hand_off(pool, asio::ip::tcp::acceptor{ io_ctx, endpoint }, options), asio::detached);
+            return;
+        }
+#if defined(SO_REUSEPORT)
+        for (std::size_t i{ 0 }; i < pool.size(); ++i) {
+            auto& io_ctx{ pool.get_io_context(i) };
+            asio::ip::tcp::acceptor acceptor{ io_ctx };
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(asio::ip::tcp::acceptor::reuse_address{ true });
+            acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>{ true });
+            acceptor.bind(endpoint);
+            acceptor.listen();
+            co_spawn(io_ctx, accept_reuse_port(pool, i, std::move(acceptor), options), asio::detached);
+        }
+#else
+        throw std::runtime_error{ "accept_mode::reuse_port needs SO_REUSEPORT" };
+#endif
+    }
+
+    inline asio::awaitable<asio::ip::tcp::socket> connect(asio::io_context& io_ctx) {
         asio::ip::tcp::resolver resolver{ io_ctx };
         asio::ip::tcp::resolver::query query{ "localhost", std::to_string(port) };
         asio::ip::tcp::resolver::iterator endpoint_iterator{ resolver.resolve(query) };
         asio::ip::tcp::socket socket{ io_ctx };
         co_await asio::async_connect(socket, endpoint_iterator, asio::use_awaitable);
+        co_return socket;
+    }
+
+    inline asio::awaitable<void> client(asio::io_context& io_ctx) {
+        fmt::print("[client] Starting\n");
+        auto socket{ co_await connect(io_ctx) };
         fmt::print("[client] Connected to server\n");
 
         for (;;) {
@@ -56,11 +308,92 @@ namespace rtc::coro::client_server_asio {
             std::size_t n{ co_await asio::async_read(socket, asio::buffer(data), asio::use_awaitable) };
             fmt::print("[client] Received {} bytes: {}\n", sizeof(data), data[0]);
 
-            if (data[0] > 3) {
+            if (is_last(data[0])) {
                 co_return;
             }
         }
     }
+
+    // Batched client
+    // Reads whatever is available, up to a whole buffer borrowed from the buffer pool, and iterates the values in place
+    // A value can be split between two reads, so the trailing bytes of a read are kept for the next one
+    inline asio::awaitable<void> client_batched(asio::io_context& io_ctx) {
+        fmt::print("[client] Starting\n");
+        auto socket{ co_await connect(io_ctx) };
+        fmt::print("[client] Connected to server\n");
+
+        auto buffer{ buffer_pool::shared().acquire(64 * 1024) };
+        std::size_t size{ 0 };
+        for (;;) {
+            size += co_await socket.async_read_some(buffer.mutable_buffer(size), asio::use_awaitable);
+            std::size_t offset{ 0 };
+            std::size_t count{ 0 };
+            int value{};
+            for (; size - offset >= sizeof(int); offset += sizeof(int), ++count) {
+                std::memcpy(&value, buffer.data() + offset, sizeof(int));
+                if (is_last(value)) {
+                    fmt::print("[client] Received {} values, last one: {}\n", count + 1, value);
+                    co_return;
+                }
+            }
+            if (count > 0) {
+                fmt::print("[client] Received {} values, last one: {}\n", count, value);
+            }
+            size -= offset;
+            std::memmove(buffer.data(), buffer.data() + offset, size);
+        }
+    }
+
+    // Pipelined client
+    // Keeps up to window requests in flight, and sends the next one as each response comes in
+    // Responses are matched to their requests by id, whatever the order they come back in, and checked against
+    // their requests' payloads, which the server echoes
+    inline std::vector<std::byte> make_payload(std::uint32_t id, std::size_t size) {
+        std::vector<std::byte> payload(size);
+        for (std::size_t i{ 0 }; i < size; ++i) {
+            payload[i] = static_cast<std::byte>(id + i);
+        }
+        return payload;
+    }
+
+    inline asio::awaitable<void> client_pipelined(asio::io_context& io_ctx, std::size_t number_of_requests,
+        std::size_t window = 16, std::size_t payload_size = 64) {
+        fmt::print("[client] Starting\n");
+        auto socket{ co_await connect(io_ctx) };
+        fmt::print("[client] Connected to server\n");
+
+        framing::frame_reader reader{ socket };
+        framing::frame_writer writer{ socket };
+        std::unordered_map<std::uint32_t, std::vector<std::byte>> in_flight{};
+        std::uint32_t next_id{ 0 };
+        auto send_next = [&]() -> asio::awaitable<void> {
+            auto id{ next_id++ };
+            auto& payload{ in_flight[id] = make_payload(id, payload_size) };
+            co_await writer.write(id, payload);
+        };
+
+        while (next_id < number_of_requests && in_flight.size() < window) {
+            co_await send_next();
+        }
+        for (std::size_t received{ 0 }; received < number_of_requests; ++received) {
+            auto response{ co_await reader.read() };
+            if (not response) {
+                throw std::runtime_error{ "connection closed with requests in flight" };
+            }
+            auto it{ in_flight.find(response->id) };
+            if (it == in_flight.end()) {
+                throw std::runtime_error{ "response to an unknown request " + std::to_string(response->id) };
+            }
+            if (response->payload != it->second) {
+                throw std::runtime_error{ "wrong response to request " + std::to_string(response->id) };
+            }
+            in_flight.erase(it);
+            if (next_id < number_of_requests) {
+                co_await send_next();
+            }
+        }
+        fmt::print("[client] Received {} responses, up to {} in flight\n", number_of_requests, window);
+    }
 }  // namespace rtc::coro::client_server_asio
 
 
@@ -73,12 +406,78 @@ inline void test_client_server_asio() {
         asio::signal_set signals(io_ctx, SIGINT, SIGTERM);
         signals.async_wait([&io_ctx](auto, auto) { io_ctx.stop(); });
 
+        // The server takes the client's connection only, and once both are done the signals stop holding run() up
+        int running{ 2 };
+        auto done{ [&signals, &running](std::exception_ptr e) {
+            try {
+                if (e) {
+                    std::rethrow_exception(e);
+                }
+            } catch (const std::exception& ex) {
+                fmt::print("Error: {}\n", ex.what());
+            }
+            if (--running == 0) {
+                signals.cancel();
+            }
+        } };
         fmt::print("Press CTRL + c to finish at anytime...\n\n");
-        co_spawn(io_ctx, server(io_ctx), asio::detached);
-        co_spawn(io_ctx, client(io_ctx), asio::detached);
+        co_spawn(io_ctx, server(io_ctx, { .max_connections = 1 }), done);
+        co_spawn(io_ctx, client(io_ctx), done);
         io_ctx.run();
     }
     catch (const std::exception& e) {
         fmt::print("Error: {}\n", e.what());
     }
 }
+
+
+inline void test_client_server_asio_pool(rtc::coro::client_server_asio::accept_mode mode, std::size_t number_of_clients,
+    std::size_t batch_size = 1) {
+    using namespace rtc::coro;
+    using namespace rtc::coro::client_server_asio;
+
+    try {
+        io_context_pool pool{};
+        start_server(pool, mode, { .batch_size = batch_size });
+        pool.run();
+
+        std::vector<std::future<void>> clients;
+        for (std::size_t i{ 0 }; i < number_of_clients; ++i) {
+            auto& io_ctx{ pool.get_io_context(pool.next_index()) };
+            clients.push_back(co_spawn(io_ctx, (batch_size > 1 ? client_batched(io_ctx) : client(io_ctx)), asio::use_future));
+        }
+        for (auto& c : clients) {
+            c.get();
+        }
+        pool.stop();
+    }
+    catch (const std::exception& e) {
+        fmt::print("Error: {}\n", e.what());
+    }
+}
+
+
+inline void test_client_server_asio_pipelined(std::size_t number_of_clients, std::size_t number_of_requests,
+    std::size_t window = 16) {
+    using namespace rtc::coro;
+    using namespace rtc::coro::client_server_asio;
+
+    try {
+        io_context_pool pool{};
+        start_server(pool, accept_mode::hand_off, { .pipelined = true });
+        pool.run();
+
+        std::vector<std::future<void>> clients;
+        for (std::size_t i{ 0 }; i < number_of_clients; ++i) {
+            auto& io_ctx{ pool.get_io_context(pool.next_index()) };
+            clients.push_back(co_spawn(io_ctx, client_pipelined(io_ctx, number_of_requests, window), asio::use_future));
+        }
+        for (auto& c : clients) {
+            c.get();
+        }
+        pool.stop();
+    }
+    catch (const std::exception& e) {
+        fmt::print("Error: {}\n", e.what());
+    }
+}
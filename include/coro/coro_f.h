@@ -9,6 +9,9 @@
 
 
 namespace rtc::coro {
+    // Every asio::awaitable call allocates a frame, through a per-thread cache of recycled frames
+    // A chain of nested calls keeps one frame alive per level, so the cache is made as deep as the usual chains
+    // (ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE, set from CMake), see bench/asio_frame_bench.cpp
     inline asio::awaitable<int> coro_f(int i) {
         fmt::print("[coro_f] &i: {}\n", fmt::ptr(&i));
         co_return ++i;
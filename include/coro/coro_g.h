@@ -1,9 +1,11 @@
 #pragma once
 
+#include "async_generator.h"
 #include "coro_ui.h"
 #include "generator.hpp"
 
 #include <asio.hpp>
+#include <chrono>
 #include <coroutine>
 #include <fmt/core.h>
 #include <fmt/format.h>
@@ -26,9 +28,29 @@ namespace rtc::coro {
         co_return;
     }
 
+    // Same sequence, but the producer waits on a timer before every value, without blocking the io_context
+    inline async_generator<int> coro_g_async() {
+        int i{ 5 };
+        asio::steady_timer timer{ co_await asio::this_coro::executor };
+        while (i--) {
+            using namespace std::chrono_literals;
+            timer.expires_after(10ms);
+            co_await timer.async_wait(asio::use_awaitable);
+            co_yield i;
+        }
+    }
+
+    inline asio::awaitable<void> call_coro_g_async() {
+        auto gen{ coro_g_async() };
+        while (auto n{ co_await gen.next() }) {
+            fmt::print("[call_coro_g_async()] {}\n", *n);
+        }
+    }
+
     inline void test_coro_g() {
         asio::io_context io_ctx{};
         co_spawn(io_ctx, call_coro_g(), asio::detached);
+        co_spawn(io_ctx, call_coro_g_async(), asio::detached);
         co_spawn(io_ctx, coro_ui, asio::detached);
         io_ctx.run();
     }
@@ -1,7 +1,12 @@
 ﻿#pragma once
 
+#include "chunked_generator.h"
+
+#include <array>
 #include <coroutine>
+#include <cstddef>  // size_t
 #include <generator.hpp>
+#include <span>
 
 
 namespace rtc::coro {
@@ -11,4 +16,16 @@ namespace rtc::coro {
             co_yield i++;
         }
     }
+
+    // Same sequence, one resume per chunk_size elements
+    template <std::size_t chunk_size = 256>
+    chunked_generator<int> coro_sequence_chunked() {
+        std::array<int, chunk_size> buffer{};
+        for (int i{};; ) {
+            for (auto& e : buffer) {
+                e = i++;
+            }
+            co_yield std::span<const int>{ buffer };
+        }
+    }
 }  // namespace rtc::coro
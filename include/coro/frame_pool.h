@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <cstddef>  // byte, size_t
+#include <new>  // operator delete, operator new
+#include <type_traits>  // true_type
+
+
+// Frame pool
+//
+// Coroutine frames are usually small and short-lived, e.g. a mul(a, b) task lives just for a multiplication
+// Instead of going to the global allocator every time, frames are recycled through per-thread free lists,
+// one free list per size class
+//
+// Notes on implementation:
+//
+//   - Sizes are rounded up to a multiple of size_class_granularity; bigger sizes than max_pooled_size are not pooled
+//   - A block freed on a different thread than the one that allocated it just goes to the freeing thread's free list
+//   - Free lists are capped, so a thread that only frees (e.g. the one that completes tasks) does not hoard memory
+//   - Free lists are released when their thread exits
+//
+// Coroutine promises can use it from their operator new/delete:
+//
+//   static void* operator new(std::size_t size) { return rtc::coro::frame_pool::allocate(size); }
+//   static void operator delete(void* ptr, std::size_t size) noexcept { rtc::coro::frame_pool::deallocate(ptr, size); }
+//
+// And frame_allocator is a standard allocator on top of it, that can be used as std::generator's allocator:
+//
+//   std::generator<int, void, rtc::coro::frame_allocator<std::byte>> coro_sequence();
+
+
+namespace rtc::coro {
+    class frame_pool {
+    public:
+        static constexpr std::size_t size_class_granularity = 32;
+        static constexpr std::size_t max_pooled_size = 2048;
+        static constexpr std::size_t max_free_blocks_per_size_class = 256;
+
+        static void* allocate(std::size_t size) {
+            if (size == 0 || size > max_pooled_size) {
+                return ::operator new(size);
+            }
+            auto index{ size_class_index(size) };
+            if (auto cache{ local_cache() }) {
+                auto& free_list{ cache->free_lists_[index] };
+                if (auto block{ free_list.head_ }) {
+                    free_list.head_ = block->next_;
+                    --free_list.size_;
+                    return block;
+                }
+            }
+            return ::operator new(size_class_size(index));
+        }
+
+        static void deallocate(void* ptr, std::size_t size) noexcept {
+            if (size == 0 || size > max_pooled_size) {
+                ::operator delete(ptr, size);
+                return;
+            }
+            auto index{ size_class_index(size) };
+            if (auto cache{ local_cache() }) {
+                auto& free_list{ cache->free_lists_[index] };
+                if (free_list.size_ < max_free_blocks_per_size_class) {
+                    free_list.head_ = ::new (ptr) free_block{ free_list.head_ };
+                    ++free_list.size_;
+                    return;
+                }
+            }
+            ::operator delete(ptr, size_class_size(index));
+        }
+
+    private:
+        static constexpr std::size_t number_of_size_classes = max_pooled_size / size_class_granularity;
+
+        struct free_block {
+            free_block* next_;
+        };
+
+        struct free_list {
+            free_block* head_{};
+            std::size_t size_{};
+        };
+
+        struct thread_cache {
+            thread_cache() noexcept {
+                thread_cache_alive_ = true;
+                thread_cache_untouched_ = false;
+            }
+            ~thread_cache() {
+                thread_cache_alive_ = false;
+                for (std::size_t index{ 0 }; index < free_lists_.size(); ++index) {
+                    while (auto block{ free_lists_[index].head_ }) {
+                        free_lists_[index].head_ = block->next_;
+                        ::operator delete(block, size_class_size(index));
+                    }
+                }
+            }
+
+            std::array<free_list, number_of_size_classes> free_lists_{};
+        };
+
+        static constexpr std::size_t size_class_index(std::size_t size) noexcept {
+            return (size - 1) / size_class_granularity;
+        }
+        static constexpr std::size_t size_class_size(std::size_t index) noexcept {
+            return (index + 1) * size_class_granularity;
+        }
+        // Returns null during thread exit, once the thread cache has been destroyed
+        static thread_cache* local_cache() noexcept {
+            if (not thread_cache_alive_ && not thread_cache_untouched_) {
+                return nullptr;
+            }
+            static thread_local thread_cache cache{};
+            return &cache;
+        }
+
+        // Trivially destructible, so they can still be checked once the thread cache has been destroyed
+        static inline thread_local bool thread_cache_alive_{};
+        static inline thread_local bool thread_cache_untouched_{ true };
+    };
+
+
+    // Frame allocator
+    // Stateless standard allocator on top of the frame pool
+    template <typename T>
+    class frame_allocator {
+    public:
+        using value_type = T;
+        using is_always_equal = std::true_type;
+
+        frame_allocator() noexcept = default;
+        template <typename U>
+        frame_allocator(const frame_allocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(frame_pool::allocate(n * sizeof(T)));
+        }
+        void deallocate(T* ptr, std::size_t n) noexcept {
+            frame_pool::deallocate(ptr, n * sizeof(T));
+        }
+
+        template <typename U>
+        friend bool operator==(const frame_allocator&, const frame_allocator<U>&) noexcept {
+            return true;
+        }
+    };
+}  // namespace rtc::coro
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "buffer_pool.h"
+
+#include <algorithm>  // min
+#include <asio.hpp>
+#include <bit>  // byteswap, endian
+#include <cstddef>  // byte, size_t
+#include <cstdint>  // uint32_t
+#include <cstring>  // memcpy, memmove
+#include <optional>
+#include <span>
+#include <stdexcept>  // runtime_error
+#include <string>  // to_string
+#include <utility>  // swap
+#include <vector>
+
+
+// Framing
+//
+// Length-prefixed binary frames over a byte stream, e.g. a TCP socket:
+//
+//   | payload size (4 bytes) | request id (4 bytes) | payload (payload size bytes) |
+//
+// Both header fields are unsigned 32-bit integers, little-endian on the wire, whatever the host's endianness
+// The request id lets a connection carry many requests at once: a response has the id of its request,
+// so responses can be written as soon as they are ready, in any order
+//
+// E.g.
+//   frame_reader reader{ socket };
+//   frame_writer writer{ socket };
+//   while (auto request{ co_await reader.read() }) {
+//       co_await writer.write(request->id, handle(request->payload));
+//   }
+//
+// Notes on implementation:
+//
+//   - frame_reader reads whatever is available, up to a buffer borrowed from the buffer pool, and decodes every whole
+//     frame in it, so a burst of small frames costs a single read; the rest of a payload bigger than the buffer is read
+//     straight into the frame
+//   - A payload size over max_payload_size is a protocol error: read throws instead of allocating it
+//   - frame_writer queues the frames written while a write is in progress, and the coroutine doing that write writes
+//     them all at once when it completes, so frames never interleave, and a burst of responses costs a single write
+//   - Neither of them is thread-safe: a connection's reader and writer are used from its io_context's thread,
+//     or from a strand
+
+
+namespace rtc::coro::framing {
+    constexpr std::size_t header_size = 2 * sizeof(std::uint32_t);
+    constexpr std::size_t max_payload_size = 16 * 1024 * 1024;
+
+    struct frame {
+        std::uint32_t id{};
+        std::vector<std::byte> payload;
+    };
+
+    struct frame_header {
+        std::uint32_t payload_size{};
+        std::uint32_t id{};
+    };
+
+    // Both ways, since swapping the bytes of a little-endian value gives back the native one
+    constexpr std::uint32_t little_endian(std::uint32_t value) noexcept {
+        if constexpr (std::endian::native == std::endian::big) {
+            return std::byteswap(value);
+        } else {
+            return value;
+        }
+    }
+
+    inline void encode_header(std::byte* out, frame_header header) noexcept {
+        auto payload_size{ little_endian(header.payload_size) };
+        auto id{ little_endian(header.id) };
+        std::memcpy(out, &payload_size, sizeof(payload_size));
+        std::memcpy(out + sizeof(payload_size), &id, sizeof(id));
+    }
+
+    inline frame_header decode_header(const std::byte* in) noexcept {
+        frame_header header{};
+        std::memcpy(&header.payload_size, in, sizeof(header.payload_size));
+        std::memcpy(&header.id, in + sizeof(header.payload_size), sizeof(header.id));
+        return { little_endian(header.payload_size), little_endian(header.id) };
+    }
+
+    // Appends a whole frame, header and payload, to out
+    inline void encode_frame(std::vector<std::byte>& out, std::uint32_t id, std::span<const std::byte> payload) {
+        if (payload.size() > max_payload_size) {
+            throw std::runtime_error{ "frame payload of " + std::to_string(payload.size()) + " bytes is too big" };
+        }
+        auto offset{ out.size() };
+        out.resize(offset + header_size + payload.size());
+        encode_header(out.data() + offset, { static_cast<std::uint32_t>(payload.size()), id });
+        std::memcpy(out.data() + offset + header_size, payload.data(), payload.size());
+    }
+
+
+    // Frame reader
+    // Reads frames from a stream until it's closed
+    template <typename stream_t>
+    class frame_reader {
+    public:
+        static constexpr std::size_t default_buffer_size = 64 * 1024;
+
+        explicit frame_reader(stream_t& stream, std::size_t buffer_size = default_buffer_size)
+            : stream_{ &stream }
+            , buffer_{ buffer_pool::shared().acquire(std::max(buffer_size, header_size)) }
+        {}
+
+        // The next frame, or none if the stream was closed between two frames
+        // Throws if it was closed in the middle of a frame, or on a protocol error
+        asio::awaitable<std::optional<frame>> read() {
+            auto header_read{ co_await fill(header_size) };
+            if (not header_read) {
+                co_return std::nullopt;
+            }
+            auto header{ decode_header(buffer_.data() + begin_) };
+            consume(header_size);
+            if (header.payload_size > max_payload_size) {
+                throw std::runtime_error{ "frame payload of " + std::to_string(header.payload_size) + " bytes is too big" };
+            }
+
+            frame f{ header.id, std::vector<std::byte>(header.payload_size) };
+            auto buffered{ std::min<std::size_t>(header.payload_size, size_) };
+            std::memcpy(f.payload.data(), buffer_.data() + begin_, buffered);
+            consume(buffered);
+            if (buffered < f.payload.size()) {
+                co_await asio::async_read(*stream_, asio::buffer(f.payload.data() + buffered, f.payload.size() - buffered),
+                    asio::use_awaitable);
+            }
+            co_return f;
+        }
+    private:
+        void consume(std::size_t n) noexcept {
+            begin_ += n;
+            size_ -= n;
+            if (size_ == 0) {
+                begin_ = 0;
+            }
+        }
+
+        // Reads until at least n bytes are buffered, n being at most a header
+        // Returns false if the stream was closed before any of them
+        asio::awaitable<bool> fill(std::size_t n) {
+            if (begin_ + n > buffer_.capacity()) {
+                std::memmove(buffer_.data(), buffer_.data() + begin_, size_);
+                begin_ = 0;
+            }
+            while (size_ < n) {
+                asio::error_code ec{};
+                auto read{ co_await stream_->async_read_some(buffer_.mutable_buffer(begin_ + size_),
+                    asio::redirect_error(asio::use_awaitable, ec)) };
+                if (ec == asio::error::eof && size_ == 0) {
+                    co_return false;
+                }
+                if (ec) {
+                    throw asio::system_error{ ec };
+                }
+                size_ += read;
+            }
+            co_return true;
+        }
+
+        stream_t* stream_;
+        pooled_buffer buffer_;
+        std::size_t begin_{};  // of the buffered bytes not read yet
+        std::size_t size_{};
+    };
+
+
+    // Frame writer
+    // Writes frames to a stream, from any number of coroutines
+    template <typename stream_t>
+    class frame_writer {
+    public:
+        explicit frame_writer(stream_t& stream)
+            : stream_{ &stream }
+        {}
+
+        // Returns once the frame has been written, or queued for the write in progress
+        // After a failed write, every write throws
+        asio::awaitable<void> write(std::uint32_t id, std::span<const std::byte> payload) {
+            if (error_) {
+                throw asio::system_error{ error_ };
+            }
+            encode_frame(queued_, id, payload);
+            if (writing_) {
+                co_return;
+            }
+            writing_ = true;
+            while (not queued_.empty()) {
+                std::swap(queued_, writing_frames_);
+                co_await asio::async_write(*stream_, asio::buffer(writing_frames_),
+                    asio::redirect_error(asio::use_awaitable, error_));
+                writing_frames_.clear();
+                if (error_) {
+                    queued_.clear();
+                    writing_ = false;
+                    throw asio::system_error{ error_ };
+                }
+            }
+            writing_ = false;
+        }
+    private:
+        stream_t* stream_;
+        std::vector<std::byte> queued_;
+        std::vector<std::byte> writing_frames_;
+        bool writing_{};
+        asio::error_code error_{};
+    };
+}  // namespace rtc::coro::framing
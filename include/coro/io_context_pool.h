@@ -0,0 +1,157 @@
+#pragma once
+
+#include "affinity.h"
+
+#include <algorithm>  // min_element
+#include <array>
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>  // size_t
+#include <memory>  // make_unique, unique_ptr
+#include <optional>
+#include <thread>  // jthread
+#include <utility>  // exchange
+#include <vector>
+
+
+// io_context pool
+//
+// One io_context per core, each one run by its own thread, pinned to that core
+// Instead of funneling every session through a single io_context, sessions are spread over the pool,
+// and every session stays on its home io_context: its socket, its timers, and its coroutine all live there,
+// so a session never needs a strand, and never migrates between threads
+//
+// E.g.
+//   io_context_pool pool{};
+//   co_spawn(pool.get_io_context(0), server(pool), asio::detached);
+//   pool.run();
+//   ...
+//   pool.stop();
+//
+// Notes on implementation:
+//
+//   - Every io_context is created with a concurrency hint of 1, since it is only run by one thread
+//   - A work guard keeps every io_context running while it has nothing to do
+//   - Load is the number of sessions currently living on an io_context; a session holds a load_token while it runs
+
+
+namespace rtc::coro {
+    class io_context_pool {
+    public:
+        // Counts a session on an io_context while it's alive
+        class load_token {
+        public:
+            load_token() = default;
+            explicit load_token(std::atomic<std::size_t>& load) noexcept
+                : load_{ &load } {
+                load_->fetch_add(1, std::memory_order_relaxed);
+            }
+            load_token(load_token&& other) noexcept
+                : load_{ std::exchange(other.load_, nullptr) }
+            {}
+            load_token& operator=(load_token&& other) noexcept {
+                if (this != &other) {
+                    release();
+                    load_ = std::exchange(other.load_, nullptr);
+                }
+                return *this;
+            }
+            ~load_token() {
+                release();
+            }
+        private:
+            void release() noexcept {
+                if (load_) {
+                    load_->fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+
+            std::atomic<std::size_t>* load_{};
+        };
+
+        explicit io_context_pool(std::size_t size = default_size()) {
+            contexts_.reserve(size);
+            for (std::size_t i{ 0 }; i < size; ++i) {
+                contexts_.push_back(std::make_unique<context>());
+            }
+        }
+        ~io_context_pool() {
+            stop();
+        }
+        io_context_pool(const io_context_pool&) = delete;
+        io_context_pool& operator=(const io_context_pool&) = delete;
+
+        // Starts one thread per io_context, pinned to core i
+        void run() {
+            for (std::size_t i{ 0 }; i < contexts_.size(); ++i) {
+                contexts_[i]->thread_ = std::jthread{ [this, i]() {
+                    pin_to_core(i);
+                    contexts_[i]->io_context_.run();
+                } };
+            }
+        }
+        void stop() {
+            for (auto& c : contexts_) {
+                c->work_guard_.reset();
+                c->io_context_.stop();
+            }
+            for (auto& c : contexts_) {
+                if (c->thread_.joinable()) {
+                    c->thread_.join();
+                }
+            }
+        }
+
+        std::size_t size() const noexcept {
+            return contexts_.size();
+        }
+        asio::io_context& get_io_context(std::size_t i) noexcept {
+            return contexts_[i]->io_context_;
+        }
+        // Round-robin
+        std::size_t next_index() noexcept {
+            return next_.fetch_add(1, std::memory_order_relaxed) % contexts_.size();
+        }
+        // The io_context with the fewest sessions; ties go round-robin, so an idle pool still spreads the sessions
+        std::size_t least_loaded_index() noexcept {
+            auto start{ next_index() };
+            auto best{ start };
+            auto best_load{ load(start) };
+            for (std::size_t n{ 1 }; n < contexts_.size() && best_load != 0; ++n) {
+                auto i{ (start + n) % contexts_.size() };
+                if (auto l{ load(i) }; l < best_load) {
+                    best = i;
+                    best_load = l;
+                }
+            }
+            return best;
+        }
+        std::size_t load(std::size_t i) const noexcept {
+            return contexts_[i]->load_.load(std::memory_order_relaxed);
+        }
+        load_token make_load_token(std::size_t i) noexcept {
+            return load_token{ contexts_[i]->load_ };
+        }
+    private:
+        // load_ is declared first, so that it outlives the io_context, whose destructor destroys the session frames
+        // still pending, and, with them, their load tokens
+        struct context {
+            std::atomic<std::size_t> load_{};
+            asio::io_context io_context_{ 1 };
+            std::optional<asio::executor_work_guard<asio::io_context::executor_type>> work_guard_{
+                asio::make_work_guard(io_context_) };
+            std::jthread thread_;
+        };
+
+        static std::size_t default_size() noexcept {
+            return number_of_cores();
+        }
+        // Best effort: a thread that can't be pinned just runs unpinned
+        static void pin_to_core(std::size_t core) noexcept {
+            pin_current_thread(std::array{ core % number_of_cores() });
+        }
+
+        std::vector<std::unique_ptr<context>> contexts_;
+        std::atomic<std::size_t> next_{};
+    };
+}  // namespace rtc::coro
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>  // bit_width
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>  // int64_t, uint64_t
+
+
+// Metrics
+//
+// Lock-free counters and latency histograms, cheap enough to leave on in production
+// Executors keep one set per thread, see executor_metrics, and sum them up into a snapshot when asked to
+// Counters are exact; latencies are sampled
+//
+// E.g.
+//   auto before{ executor.get_metrics_snapshot() };
+//   ...
+//   auto after{ executor.get_metrics_snapshot() };
+//   fmt::print("{} resumes/s, p99 schedule to run {} ns\n",
+//       per_second(before, after, &executor_metrics_snapshot::resumes), after.schedule_to_run.percentile(99));
+//
+// The metrics mode is chosen at compile time, with the RTC_CORO_METRICS macro:
+//
+//   - RTC_CORO_METRICS=0: off, metrics compile to nothing
+//   - RTC_CORO_METRICS=1: executor, every executor counts and times the work items it runs (default)
+//   - RTC_CORO_METRICS=2: task, every ctask also keeps its own timings, at the cost of three more clock reads per task
+//
+// Notes on implementation:
+//
+//   - Counters are relaxed atomics; every thread writes to its own, so they are never contended
+//   - Histograms are log-linear, as HDR histograms are: values below 2^precision_bits get a bucket each,
+//     and every power of two above that is split into 2^(precision_bits - 1) buckets,
+//     so a value is off by at most 1 / 2^(precision_bits - 1), about 6%, across the whole 64-bit range
+//   - Recording a value is one relaxed increment of its bucket, and one of the sum; a snapshot is a copy of the buckets,
+//     so it may be torn by a few values still being recorded, which statistics don't mind
+
+
+#ifndef RTC_CORO_METRICS
+#define RTC_CORO_METRICS 1
+#endif
+
+
+namespace rtc::coro::metrics {
+    enum class mode_type { off = 0, executor = 1, task = 2 };
+
+    inline constexpr mode_type mode{ static_cast<mode_type>(RTC_CORO_METRICS) };
+    inline constexpr bool enabled{ mode != mode_type::off };
+    inline constexpr bool task_enabled{ mode == mode_type::task };
+
+    static_assert(mode == mode_type::off || mode == mode_type::executor || mode == mode_type::task,
+        "RTC_CORO_METRICS should be 0 (off), 1 (executor), or 2 (task)");
+
+
+    // Clock
+    // Timestamps are nanoseconds of the steady clock
+    using clock = std::chrono::steady_clock;
+
+    inline std::uint64_t now() noexcept {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count());
+    }
+
+
+    // Counter
+    // Signed counters can go down, e.g. the number of tasks in flight, which one thread increments and another decrements
+    template <typename T = std::uint64_t>
+    class counter {
+    public:
+        void add(T n = 1) noexcept {
+            value_.fetch_add(n, std::memory_order_relaxed);
+        }
+        T load() const noexcept {
+            return value_.load(std::memory_order_relaxed);
+        }
+    private:
+        std::atomic<T> value_{};
+    };
+
+
+    // Histogram buckets
+    struct buckets {
+        static constexpr std::size_t precision_bits = 5;
+        static constexpr std::size_t linear_count = std::size_t{ 1 } << precision_bits;
+        static constexpr std::size_t sub_count = linear_count / 2;
+        static constexpr std::size_t count = linear_count + (64 - precision_bits) * sub_count;
+
+        static constexpr std::size_t index_of(std::uint64_t value) noexcept {
+            auto width{ static_cast<std::size_t>(std::bit_width(value)) };
+            if (width <= precision_bits) {
+                return static_cast<std::size_t>(value);
+            }
+            auto shift{ width - precision_bits };
+            return linear_count + (shift - 1) * sub_count + static_cast<std::size_t>((value >> shift) - sub_count);
+        }
+        // Highest value that falls into the bucket
+        static constexpr std::uint64_t highest_of(std::size_t index) noexcept {
+            if (index < linear_count) {
+                return index;
+            }
+            auto shift{ (index - linear_count) / sub_count + 1 };
+            auto lowest{ static_cast<std::uint64_t>((index - linear_count) % sub_count + sub_count) << shift };
+            return lowest + ((std::uint64_t{ 1 } << shift) - 1);
+        }
+    };
+
+    static_assert(buckets::index_of(buckets::linear_count - 1) == buckets::linear_count - 1);
+    static_assert(buckets::index_of(buckets::linear_count) == buckets::linear_count);
+    static_assert(buckets::index_of(~std::uint64_t{}) == buckets::count - 1);
+    static_assert(buckets::highest_of(buckets::count - 1) == ~std::uint64_t{});
+
+
+    // Histogram snapshot
+    // Plain counts, which can be added up, e.g. over threads, and queried
+    class histogram_snapshot {
+    public:
+        histogram_snapshot& operator+=(const histogram_snapshot& other) noexcept {
+            for (std::size_t i{ 0 }; i < buckets::count; ++i) {
+                counts_[i] += other.counts_[i];
+            }
+            count_ += other.count_;
+            sum_ += other.sum_;
+            return *this;
+        }
+        void add(std::size_t index, std::uint64_t n) noexcept {
+            counts_[index] += n;
+            count_ += n;
+        }
+        void add_sum(std::uint64_t sum) noexcept {
+            sum_ += sum;
+        }
+
+        std::uint64_t count() const noexcept {
+            return count_;
+        }
+        std::uint64_t mean() const noexcept {
+            return count_ == 0 ? 0 : sum_ / count_;
+        }
+        // Value below which percent of the values fall, e.g. percentile(99)
+        // As HDR histograms do, it is the highest value of the bucket it falls into, so it never understates
+        std::uint64_t percentile(double percent) const noexcept {
+            if (count_ == 0) {
+                return 0;
+            }
+            auto rank{ static_cast<std::uint64_t>(percent / 100.0 * static_cast<double>(count_) + 0.5) };
+            rank = rank == 0 ? 1 : (rank > count_ ? count_ : rank);
+            std::uint64_t seen{};
+            for (std::size_t i{ 0 }; i < buckets::count; ++i) {
+                if (seen += counts_[i]; seen >= rank) {
+                    return buckets::highest_of(i);
+                }
+            }
+            return max();
+        }
+        std::uint64_t max() const noexcept {
+            for (auto i{ buckets::count }; i > 0; --i) {
+                if (counts_[i - 1] != 0) {
+                    return buckets::highest_of(i - 1);
+                }
+            }
+            return 0;
+        }
+    private:
+        std::array<std::uint64_t, buckets::count> counts_{};
+        std::uint64_t count_{};
+        std::uint64_t sum_{};
+    };
+
+
+    // Histogram
+    class histogram {
+    public:
+        void record(std::uint64_t value) noexcept {
+            counts_[buckets::index_of(value)].fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(value, std::memory_order_relaxed);
+        }
+        void add_to(histogram_snapshot& snapshot) const noexcept {
+            for (std::size_t i{ 0 }; i < buckets::count; ++i) {
+                if (auto n{ counts_[i].load(std::memory_order_relaxed) }) {
+                    snapshot.add(i, n);
+                }
+            }
+            snapshot.add_sum(sum_.load(std::memory_order_relaxed));
+        }
+    private:
+        std::array<std::atomic<std::uint64_t>, buckets::count> counts_{};
+        std::atomic<std::uint64_t> sum_{};
+    };
+
+
+    // Rate of a counter, per second, between two snapshots of anything with a taken_at time point
+    template <typename snapshot_t, typename T>
+    double per_second(const snapshot_t& earlier, const snapshot_t& later, T snapshot_t::* counter) noexcept {
+        auto seconds{ std::chrono::duration<double>(later.taken_at - earlier.taken_at).count() };
+        return seconds <= 0 ? 0.0 : static_cast<double>(later.*counter - earlier.*counter) / seconds;
+    }
+
+
+    // Stamp
+    // A timestamp that is only kept if metrics are on; otherwise it takes no space
+    template <bool enabled = enabled>
+    class stamp {
+    public:
+        void set(std::uint64_t timestamp) noexcept {
+            timestamp_ = timestamp;
+        }
+        std::uint64_t get() const noexcept {
+            return timestamp_;
+        }
+    private:
+        std::uint64_t timestamp_{};
+    };
+
+    template <>
+    class stamp<false> {
+    public:
+        void set(std::uint64_t) noexcept {}
+        std::uint64_t get() const noexcept {
+            return 0;
+        }
+    };
+
+
+    // Task timings
+    // Where a task's time went: how long it was queued before its body started, and how long it then took to complete,
+    // suspensions included; zero while unknown
+    struct task_timings {
+        std::chrono::nanoseconds queued{};
+        std::chrono::nanoseconds active{};
+    };
+
+    // Task clock
+    // Only kept in the task mode; otherwise it takes no space, and reading the clock does nothing
+    // The stamps are written by whichever thread creates, starts, or completes the task, and read by any other
+    template <bool enabled = task_enabled>
+    class task_clock {
+    public:
+        task_clock() noexcept
+            : created_{ now() }
+        {}
+        void started() noexcept {
+            started_.store(now(), std::memory_order_relaxed);
+        }
+        void completed() noexcept {
+            completed_.store(now(), std::memory_order_relaxed);
+        }
+        task_timings get() const noexcept {
+            auto started{ started_.load(std::memory_order_relaxed) };
+            auto completed{ completed_.load(std::memory_order_relaxed) };
+            task_timings timings{};
+            if (started != 0) {
+                timings.queued = std::chrono::nanoseconds{ started - created_ };
+                if (completed != 0) {
+                    timings.active = std::chrono::nanoseconds{ completed - started };
+                }
+            }
+            return timings;
+        }
+    private:
+        std::uint64_t created_;
+        std::atomic<std::uint64_t> started_{};
+        std::atomic<std::uint64_t> completed_{};
+    };
+
+    template <>
+    class task_clock<false> {
+    public:
+        void started() noexcept {}
+        void completed() noexcept {}
+        task_timings get() const noexcept {
+            return {};
+        }
+    };
+}  // namespace rtc::coro::metrics
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <array>
+#include <concepts>  // default_initializable, derived_from
+#include <cstddef>  // size_t
+#include <functional>  // invoke
+#include <iterator>  // default_sentinel_t
+#include <generator.hpp>
+#include <optional>
+#include <ranges>  // input_range, range_value_t, views::all, views::all_t
+#include <span>
+#include <tuple>  // apply, tuple, tuple_cat
+#include <type_traits>  // decay_t, false_type, invoke_result_t, remove_cvref_t, true_type
+#include <utility>  // as_const, declval, exchange, forward, move
+
+
+// Pipeline
+//
+// Every stage written as a generator of its own, e.g.
+//
+//   std::generator<int> squares(std::generator<int> g) { for (auto i : g) { co_yield i * i; } }
+//
+// or nested with std::ranges::elements_of, adds a coroutine frame, and a resume per element per stage
+// Pipeline stages are plain objects instead, which are fused into a single step function,
+// and run inside the frame of a single generator:
+//
+//   using namespace rtc::coro::pipeline;
+//   for (auto chunk : coro_sequence() | filter(is_even) | map(square) | take(1000) | chunk<64>()) { ... }
+//
+// Stages:
+//   - map(f): f(v)
+//   - filter(p): v if p(v)
+//   - take(n): the first n values
+//   - chunk<N>(): spans of up to N values, of a buffer that lives in the pipeline; the last span can be shorter
+//
+// Notes on implementation:
+//
+//   - Stages are descriptions until the pipeline is iterated; then every stage is bound to the type of its input,
+//     e.g. chunk<N> to a std::array<T, N> buffer, and the bound stages are linked
+//   - Since | is left associative, source | filter(p) | map(f) first gives a fused pipeline, which map(f) is appended to,
+//     rather than a generator, which map(f) would be applied to
+//   - A step takes one value and returns at most one value; the source stops being pulled once any stage is done
+//   - Stages that buffer, i.e. chunk, hand out what they have left when the source ends or the pipeline stops,
+//     and it goes through the stages after them
+//   - Nothing is allocated but the frame of the one generator
+
+
+namespace rtc::coro::pipeline {
+    // Bound stages
+    // Every one of them has an input and an output type, a step, a flush, and tells whether it won't output anymore
+    template <typename T, typename F>
+    class map_step {
+    public:
+        using input_type = T;
+        using output_type = std::decay_t<std::invoke_result_t<F&, T&&>>;
+
+        explicit map_step(F f)
+            : f_{ std::move(f) }
+        {}
+        std::optional<output_type> step(T v) {
+            return std::invoke(f_, std::move(v));
+        }
+        std::optional<output_type> flush() noexcept {
+            return std::nullopt;
+        }
+        bool done() const noexcept {
+            return false;
+        }
+    private:
+        F f_;
+    };
+
+    template <typename T, typename P>
+    class filter_step {
+    public:
+        using input_type = T;
+        using output_type = T;
+
+        explicit filter_step(P p)
+            : p_{ std::move(p) }
+        {}
+        std::optional<output_type> step(T v) {
+            if (std::invoke(p_, std::as_const(v))) {
+                return v;
+            }
+            return std::nullopt;
+        }
+        std::optional<output_type> flush() noexcept {
+            return std::nullopt;
+        }
+        bool done() const noexcept {
+            return false;
+        }
+    private:
+        P p_;
+    };
+
+    template <typename T>
+    class take_step {
+    public:
+        using input_type = T;
+        using output_type = T;
+
+        explicit take_step(std::size_t n) noexcept
+            : n_{ n }
+        {}
+        std::optional<output_type> step(T v) {
+            if (n_ == 0) {
+                return std::nullopt;
+            }
+            --n_;
+            return v;
+        }
+        std::optional<output_type> flush() noexcept {
+            return std::nullopt;
+        }
+        bool done() const noexcept {
+            return n_ == 0;
+        }
+    private:
+        std::size_t n_;
+    };
+
+    template <typename T, std::size_t N>
+    class chunk_step {
+    public:
+        using input_type = T;
+        using output_type = std::span<const T>;
+
+        // A full span is only handed out once, and it has been consumed by the time the next value comes
+        std::optional<output_type> step(T v) {
+            if (size_ == N) {
+                size_ = 0;
+            }
+            buffer_[size_++] = std::move(v);
+            if (size_ == N) {
+                return output_type{ buffer_ };
+            }
+            return std::nullopt;
+        }
+        std::optional<output_type> flush() noexcept {
+            if (size_ == 0 || size_ == N) {
+                return std::nullopt;
+            }
+            return output_type{ buffer_.data(), std::exchange(size_, 0) };
+        }
+        bool done() const noexcept {
+            return false;
+        }
+    private:
+        std::array<T, N> buffer_{};
+        std::size_t size_{ 0 };
+    };
+
+
+    // Stage descriptions
+    // What map, filter, take, and chunk return; they are bound to their input type once applied to a source
+    struct stage_base {};
+
+    template <typename F>
+    class map_stage : public stage_base {
+    public:
+        explicit map_stage(F f)
+            : f_{ std::move(f) }
+        {}
+        template <typename T>
+        auto bind() && {
+            return map_step<T, F>{ std::move(f_) };
+        }
+    private:
+        F f_;
+    };
+
+    template <typename P>
+    class filter_stage : public stage_base {
+    public:
+        explicit filter_stage(P p)
+            : p_{ std::move(p) }
+        {}
+        template <typename T>
+        auto bind() && {
+            return filter_step<T, P>{ std::move(p_) };
+        }
+    private:
+        P p_;
+    };
+
+    class take_stage : public stage_base {
+    public:
+        explicit take_stage(std::size_t n) noexcept
+            : n_{ n }
+        {}
+        template <typename T>
+        auto bind() && {
+            return take_step<T>{ n_ };
+        }
+    private:
+        std::size_t n_;
+    };
+
+    template <std::size_t N>
+    class chunk_stage : public stage_base {
+    public:
+        static_assert(N > 0);
+
+        template <typename T>
+        auto bind() && {
+            return chunk_step<T, N>{};
+        }
+    };
+
+    template <typename F>
+    auto map(F f) {
+        return map_stage<F>{ std::move(f) };
+    }
+    template <typename P>
+    auto filter(P p) {
+        return filter_stage<P>{ std::move(p) };
+    }
+    inline auto take(std::size_t n) {
+        return take_stage{ n };
+    }
+    template <std::size_t N>
+    auto chunk() {
+        return chunk_stage<N>{};
+    }
+
+    template <typename T>
+    concept is_stage = std::derived_from<std::remove_cvref_t<T>, stage_base>;
+
+
+    // A sequence of stage descriptions, e.g. filter(is_even) | map(square)
+    template <is_stage... stages_t>
+    class stages {
+    public:
+        explicit stages(std::tuple<stages_t...> s)
+            : stages_{ std::move(s) }
+        {}
+        std::tuple<stages_t...>&& release() && {
+            return std::move(stages_);
+        }
+    private:
+        std::tuple<stages_t...> stages_;
+    };
+
+
+    // Linked bound stages
+    // Every value that comes out of a step goes straight into the next step
+    template <typename step_t, typename next_t = void>
+    class link {
+    public:
+        using input_type = typename step_t::input_type;
+        using output_type = typename next_t::output_type;
+        static constexpr std::size_t size = 1 + next_t::size;
+
+        link(step_t step, next_t next)
+            : step_{ std::move(step) }
+            , next_{ std::move(next) }
+        {}
+        std::optional<output_type> step(input_type v) {
+            if (auto r{ step_.step(std::move(v)) }) {
+                return next_.step(std::move(*r));
+            }
+            return std::nullopt;
+        }
+        // Flushes the i-th stage, and sends whatever it hands out through the stages after it
+        std::optional<output_type> flush(std::size_t i) {
+            if (i != 0) {
+                return next_.flush(i - 1);
+            }
+            if (auto v{ step_.flush() }) {
+                return next_.step(std::move(*v));
+            }
+            return std::nullopt;
+        }
+        bool done() const noexcept {
+            return step_.done() || next_.done();
+        }
+    private:
+        step_t step_;
+        next_t next_;
+    };
+
+    template <typename step_t>
+    class link<step_t, void> {
+    public:
+        using input_type = typename step_t::input_type;
+        using output_type = typename step_t::output_type;
+        static constexpr std::size_t size = 1;
+
+        explicit link(step_t step)
+            : step_{ std::move(step) }
+        {}
+        std::optional<output_type> step(input_type v) {
+            return step_.step(std::move(v));
+        }
+        std::optional<output_type> flush(std::size_t i) {
+            return i == 0 ? step_.flush() : std::nullopt;
+        }
+        bool done() const noexcept {
+            return step_.done();
+        }
+    private:
+        step_t step_;
+    };
+
+    template <typename T, is_stage stage_t>
+    auto bind_all(stage_t&& stage) {
+        auto step{ std::move(stage).template bind<T>() };
+        return link<decltype(step)>{ std::move(step) };
+    }
+    template <typename T, is_stage stage_t, is_stage... rest_t>
+        requires (sizeof...(rest_t) > 0)
+    auto bind_all(stage_t&& stage, rest_t&&... rest) {
+        auto step{ std::move(stage).template bind<T>() };
+        auto next{ bind_all<typename decltype(step)::output_type>(std::move(rest)...) };
+        return link<decltype(step), decltype(next)>{ std::move(step), std::move(next) };
+    }
+
+
+    // Where the pipeline's generator keeps the value it yields
+    // GCC keeps the locals of a coroutine in its frame, and going through an optional there, for every element,
+    // is measurably slower than through a plain value
+    template <typename T>
+    class yield_slot {
+    public:
+        // Whether there was a value
+        bool assign(std::optional<T>&& v) {
+            if (not v) {
+                return false;
+            }
+            value_ = std::move(*v);
+            return true;
+        }
+        T&& get() noexcept {
+            return std::move(value_);
+        }
+    private:
+        T value_{};
+    };
+
+    template <typename T>
+        requires (not std::default_initializable<T>)
+    class yield_slot<T> {
+    public:
+        bool assign(std::optional<T>&& v) {
+            value_ = std::move(v);
+            return value_.has_value();
+        }
+        T&& get() noexcept {
+            return std::move(*value_);
+        }
+    private:
+        std::optional<T> value_;
+    };
+
+
+    // The one generator that runs the whole pipeline
+    template <std::ranges::input_range source_t, typename link_t>
+    std::generator<typename link_t::output_type> run(source_t source, link_t pipeline) {
+        yield_slot<typename link_t::output_type> slot{};
+        if (not pipeline.done()) {
+            for (auto&& v : source) {
+                if (slot.assign(pipeline.step(std::forward<decltype(v)>(v)))) {
+                    co_yield slot.get();
+                }
+                if (pipeline.done()) {
+                    break;
+                }
+            }
+        }
+        for (std::size_t i{ 0 }; i < link_t::size; ++i) {
+            if (slot.assign(pipeline.flush(i))) {
+                co_yield slot.get();
+            }
+        }
+    }
+
+
+    // A source with stages applied to it
+    // Stages are only bound, and the generator only created, once it's iterated,
+    // so that every stage piped into it, e.g. source | filter(p) | map(f), is fused into the same generator
+    template <std::ranges::input_range source_t, is_stage... stages_t>
+    class fused {
+    public:
+        using value_type = std::ranges::range_value_t<source_t>;
+        using link_type = decltype(bind_all<value_type>(std::declval<stages_t>()...));
+        using generator_type = std::generator<typename link_type::output_type>;
+
+        fused(source_t source, std::tuple<stages_t...> s)
+            : source_{ std::move(source) }
+            , stages_{ std::move(s) }
+        {}
+        template <is_stage stage_t>
+        auto append(stage_t&& stage) && {
+            return fused<source_t, stages_t..., std::remove_cvref_t<stage_t>>{ std::move(source_),
+                std::tuple_cat(std::move(stages_), std::tuple<std::remove_cvref_t<stage_t>>{ std::forward<stage_t>(stage) }) };
+        }
+        // The pipeline's generator
+        generator_type generate() && {
+            return std::apply([this](auto&&... s) { return run(std::move(source_), bind_all<value_type>(std::move(s)...)); },
+                std::move(stages_));
+        }
+
+        // Like a generator, it can only be iterated once
+        auto begin() {
+            generator_.emplace(std::move(*this).generate());
+            return generator_->begin();
+        }
+        std::default_sentinel_t end() const noexcept {
+            return {};
+        }
+    private:
+        source_t source_;
+        std::tuple<stages_t...> stages_;
+        std::optional<generator_type> generator_;
+    };
+
+    template <typename T>
+    struct is_fused_impl : std::false_type {};
+    template <typename source_t, typename... stages_t>
+    struct is_fused_impl<fused<source_t, stages_t...>> : std::true_type {};
+    template <typename T>
+    concept is_fused = is_fused_impl<std::remove_cvref_t<T>>::value;
+
+
+    // Composition
+    template <is_stage lhs_t, is_stage rhs_t>
+    auto operator|(lhs_t&& lhs, rhs_t&& rhs) {
+        return stages<std::remove_cvref_t<lhs_t>, std::remove_cvref_t<rhs_t>>{
+            std::tuple<std::remove_cvref_t<lhs_t>, std::remove_cvref_t<rhs_t>>{ std::forward<lhs_t>(lhs), std::forward<rhs_t>(rhs) } };
+    }
+    template <typename... stages_t, is_stage rhs_t>
+    auto operator|(stages<stages_t...>&& lhs, rhs_t&& rhs) {
+        return stages<stages_t..., std::remove_cvref_t<rhs_t>>{
+            std::tuple_cat(std::move(lhs).release(), std::tuple<std::remove_cvref_t<rhs_t>>{ std::forward<rhs_t>(rhs) }) };
+    }
+
+    // Application to a source, e.g. a std::generator, which is moved into the pipeline
+    template <std::ranges::input_range source_t, is_stage stage_t>
+        requires (not is_stage<source_t> && not is_fused<source_t>)
+    auto operator|(source_t&& source, stage_t&& stage) {
+        return fused<std::views::all_t<source_t>, std::remove_cvref_t<stage_t>>{ std::views::all(std::forward<source_t>(source)),
+            std::tuple<std::remove_cvref_t<stage_t>>{ std::forward<stage_t>(stage) } };
+    }
+    template <std::ranges::input_range source_t, typename... stages_t>
+        requires (not is_stage<source_t> && not is_fused<source_t>)
+    auto operator|(source_t&& source, stages<stages_t...>&& s) {
+        return fused<std::views::all_t<source_t>, stages_t...>{ std::views::all(std::forward<source_t>(source)),
+            std::move(s).release() };
+    }
+    template <typename source_t, typename... stages_t, is_stage stage_t>
+    auto operator|(fused<source_t, stages_t...>&& lhs, stage_t&& stage) {
+        return std::move(lhs).append(std::forward<stage_t>(stage));
+    }
+}  // namespace rtc::coro::pipeline
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>  // min
+#include <chrono>
+#include <stdexcept>  // invalid_argument
+
+
+// Token bucket
+//
+// Rate limiter: tokens are added at a constant rate, up to a burst size, and every message takes a token
+// take never blocks; it returns how long the caller should wait before going on, so it can be used with any timer,
+// e.g. an asio::steady_timer, and a single thread can pace as many buckets as it likes
+//
+// E.g.
+//   token_bucket bucket{ 1000.0, 10.0 };  // 1000 messages per second, in bursts of up to 10
+//   if (auto delay{ bucket.take() }; delay > token_bucket::duration::zero()) {
+//       timer.expires_after(delay);
+//       co_await timer.async_wait(asio::use_awaitable);
+//   }
+//
+// Notes on implementation:
+//
+//   - The bucket starts full, so the first burst goes out right away
+//   - Tokens can go negative: a take on an empty bucket borrows the token, and returns the time until it's repaid;
+//     so a caller that waits for that time, and then sends, keeps to the rate without taking again
+
+
+namespace rtc::coro {
+    class token_bucket {
+    public:
+        using clock = std::chrono::steady_clock;
+        using duration = clock::duration;
+
+        // Throws if the rate isn't positive, since take couldn't ever repay a borrowed token
+        token_bucket(double tokens_per_second, double burst_size)
+            : tokens_per_second_{ tokens_per_second }
+            , burst_size_{ burst_size }
+            , tokens_{ burst_size }
+            , last_refill_{ clock::now() } {
+            if (not (tokens_per_second > 0.0)) {
+                throw std::invalid_argument{ "token_bucket: tokens_per_second should be positive" };
+            }
+        }
+        // Takes n tokens, and returns how long to wait until they're available, zero if they already are
+        duration take(double n = 1.0) noexcept {
+            return take(n, clock::now());
+        }
+        duration take(double n, clock::time_point now) noexcept {
+            refill(now);
+            tokens_ -= n;
+            if (tokens_ >= 0.0) {
+                return duration::zero();
+            }
+            return std::chrono::ceil<duration>(std::chrono::duration<double>{ -tokens_ / tokens_per_second_ });
+        }
+    private:
+        void refill(clock::time_point now) noexcept {
+            std::chrono::duration<double> elapsed{ now - last_refill_ };
+            tokens_ = std::min(burst_size_, tokens_ + elapsed.count() * tokens_per_second_);
+            last_refill_ = now;
+        }
+
+        double tokens_per_second_;
+        double burst_size_;
+        double tokens_;
+        clock::time_point last_refill_;
+    };
+}  // namespace rtc::coro
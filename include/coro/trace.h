@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>  // min, sort
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>  // uint32_t, uint64_t
+#include <cstdlib>  // atexit
+#include <fmt/core.h>
+#include <memory>  // make_unique, unique_ptr
+#include <mutex>  // lock_guard
+#include <stop_token>
+#include <string_view>
+#include <thread>  // jthread
+#include <vector>
+
+
+// Trace
+//
+// The examples trace every coroutine hook (get_return_object, initial_suspend, await_ready...)
+// Printing each of those events takes a global mutex, which serializes all the executor threads
+//
+// The trace mode is chosen at compile time, with the RTC_CORO_TRACE macro:
+//
+//   - RTC_CORO_TRACE=0: off, tracing compiles to nothing
+//   - RTC_CORO_TRACE=1: print, every event is printed as it happens, under a global mutex (default)
+//   - RTC_CORO_TRACE=2: ring buffer, every thread records its events into its own ring buffer, without locking,
+//     and a background thread drains and prints them, sorted by time
+//
+// Notes on implementation:
+//
+//   - Each ring buffer has a single producer, its thread, and a single consumer, the dumper
+//   - A full ring buffer drops new events, and counts them, instead of blocking its thread
+//   - Names and texts are truncated to fit a fixed-size event
+//   - Ring buffers outlive their threads, so that the last events of a thread can still be dumped;
+//     the registry is never destroyed, so threads can keep tracing during static destruction
+//   - Whatever is left in the ring buffers is dumped at exit
+
+
+#ifndef RTC_CORO_TRACE
+#define RTC_CORO_TRACE 1
+#endif
+
+
+namespace rtc::coro::trace {
+    enum class mode_type { off = 0, print = 1, ring_buffer = 2 };
+
+    inline constexpr mode_type mode{ static_cast<mode_type>(RTC_CORO_TRACE) };
+    inline constexpr bool enabled{ mode != mode_type::off };
+
+    static_assert(mode == mode_type::off || mode == mode_type::print || mode == mode_type::ring_buffer,
+        "RTC_CORO_TRACE should be 0 (off), 1 (print), or 2 (ring buffer)");
+
+
+    // Mutex for the print mode
+    inline std::mutex& print_mutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+
+    // Event
+    struct event {
+        static constexpr std::size_t max_name_size = 31;
+        static constexpr std::size_t max_text_size = 63;
+
+        std::uint64_t timestamp_{};  // nanoseconds, steady clock
+        std::uint32_t thread_{};
+        std::uint32_t level_{};
+        std::array<char, max_name_size + 1> name_{};
+        std::array<char, max_text_size + 1> text_{};
+
+        std::string_view name() const noexcept {
+            return name_.data();
+        }
+        std::string_view text() const noexcept {
+            return text_.data();
+        }
+    };
+
+
+    // Ring buffer
+    // Lock-free single producer, single consumer queue of events
+    class ring_buffer {
+    public:
+        static constexpr std::size_t capacity = 1024;  // a power of two
+
+        explicit ring_buffer(std::uint32_t thread) noexcept
+            : thread_{ thread }
+        {}
+        // Producer side, only called from the owning thread
+        void record(std::string_view name, std::string_view text, std::size_t level) noexcept {
+            auto head{ head_.load(std::memory_order_relaxed) };
+            if (head - tail_.load(std::memory_order_acquire) == capacity) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto& e{ events_[head & (capacity - 1)] };
+            e.timestamp_ = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+            e.thread_ = thread_;
+            e.level_ = static_cast<std::uint32_t>(level);
+            copy_truncated(e.name_, name);
+            copy_truncated(e.text_, text);
+            head_.store(head + 1, std::memory_order_release);
+        }
+        // Consumer side, only called from the dumper
+        void drain(std::vector<event>& out) {
+            auto tail{ tail_.load(std::memory_order_relaxed) };
+            auto head{ head_.load(std::memory_order_acquire) };
+            for (; tail != head; ++tail) {
+                out.push_back(events_[tail & (capacity - 1)]);
+            }
+            tail_.store(tail, std::memory_order_release);
+        }
+        std::size_t take_dropped() noexcept {
+            return dropped_.exchange(0, std::memory_order_relaxed);
+        }
+        std::uint32_t thread() const noexcept {
+            return thread_;
+        }
+    private:
+        template <std::size_t N>
+        static void copy_truncated(std::array<char, N>& to, std::string_view from) noexcept {
+            auto size{ std::min(from.size(), N - 1) };
+            from.copy(to.data(), size);
+            to[size] = '\0';
+        }
+
+        std::array<event, capacity> events_;
+        alignas(64) std::atomic<std::size_t> head_{};
+        alignas(64) std::atomic<std::size_t> tail_{};
+        std::atomic<std::size_t> dropped_{};
+        std::uint32_t thread_;
+    };
+
+
+    // Registry
+    // Keeps all the ring buffers, and the background thread that dumps them
+    class registry {
+    public:
+        static registry& instance() {
+            static auto* instance{ new registry{} };  // never destroyed, see notes above
+            return *instance;
+        }
+        ring_buffer& local_ring_buffer() {
+            static thread_local ring_buffer* local{ nullptr };
+            if (not local) {
+                std::lock_guard lock{ mutex_ };
+                rings_.push_back(std::make_unique<ring_buffer>(static_cast<std::uint32_t>(rings_.size())));
+                local = rings_.back().get();
+            }
+            return *local;
+        }
+        // Drains all the ring buffers, and prints their events sorted by time
+        void dump() {
+            std::lock_guard lock{ mutex_ };
+            events_.clear();
+            for (auto& ring : rings_) {
+                ring->drain(events_);
+                if (auto dropped{ ring->take_dropped() }) {
+                    fmt::print("[trace] thread {}: {} events dropped\n", ring->thread(), dropped);
+                }
+            }
+            std::ranges::sort(events_, {}, &event::timestamp_);
+            for (const auto& e : events_) {
+                fmt::print("{:>16} t{:<3}{:{}}{} [{}]\n",
+                    e.timestamp_, e.thread_, "", e.level_ * 8, (e.name().empty() ? "undefined" : e.name()), e.text());
+            }
+        }
+    private:
+        registry()
+            : dumper_{ [this](std::stop_token stoken) { run_dumper(stoken); } }
+        {
+            std::atexit([]() { registry::instance().dump(); });
+        }
+        void run_dumper(std::stop_token stoken) {
+            while (not stoken.stop_requested()) {
+                std::this_thread::sleep_for(dump_period);
+                dump();
+            }
+        }
+
+        static constexpr std::chrono::milliseconds dump_period{ 100 };
+
+        std::mutex mutex_;  // only taken when a thread registers, and by the dumper
+        std::vector<std::unique_ptr<ring_buffer>> rings_;
+        std::vector<event> events_;
+        std::jthread dumper_;
+    };
+
+
+    // Records an event into the calling thread's ring buffer
+    // Does nothing unless the trace mode is ring_buffer
+    inline void record(std::string_view name, std::string_view text, std::size_t level = 0) noexcept {
+        if constexpr (mode == mode_type::ring_buffer) {
+            registry::instance().local_ring_buffer().record(name, text, level);
+        }
+    }
+
+    // Prints what is left in the ring buffers
+    inline void dump() {
+        if constexpr (mode == mode_type::ring_buffer) {
+            registry::instance().dump();
+        }
+    }
+}  // namespace rtc::coro::trace
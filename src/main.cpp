@@ -31,6 +31,8 @@ int main() {
     fmt::print("[Testing coro_f...]\n\n"); test_coro_f();
     fmt::print("\n\n[Testing coro_g...]\n\n"); test_coro_g();
     fmt::print("\n\n[Testing client_server_asio...]\n\n"); test_client_server_asio();
+    fmt::print("\n\n[Testing client_server_asio_pool...]\n\n"); test_client_server_asio_pool(client_server_asio::accept_mode::hand_off, 4);
+    fmt::print("\n\n[Testing client_server_asio_pipelined...]\n\n"); test_client_server_asio_pipelined(4, 1000);
     fmt::print("\n\n[Testing my_coro...]\n\n"); test_my_coro();
     fmt::print("\n\n[Testing example_1...]\n\n"); example_1();
     fmt::print("\n\n[Testing example_2...]\n\n"); example_2();
@@ -41,4 +43,5 @@ int main() {
     fmt::print("\n\n[Testing example_4b...]\n\n"); example_4b();
     fmt::print("\n\n[Testing example_4c...]\n\n"); example_4c();
     fmt::print("\n\n[Testing example_4d...]\n\n"); example_4d();
+    fmt::print("\n\n[Testing example_4d_sync...]\n\n"); example_4d_sync();
 }